@@ -0,0 +1,226 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/param.h>
+
+#include "err.h"
+#include "cgroup.h"
+#include "capacity.h"
+
+
+/* append a note to the capacity reason */
+static void capacity_note(capacity *c, const char *note)
+{
+    size_t len=strlen(c->reason);
+
+    snprintf(c->reason+len, CAPACITY_REASON_LEN-len, "%s%s", 
+             (len>0) ? ", " : "", note);
+}
+
+/* count the cpus in a cpuset list such as 0-3,8,10-11. Returns -1 if the
+   list can't be read. */
+static int capacity_count_cpuset(const char *filename)
+{
+    char buf[4096];
+    char *p=buf;
+    FILE *in;
+    int n=0;
+
+    in=fopen(filename, "r");
+    if (!in)
+        return -1;
+    if (!fgets(buf, sizeof(buf), in))
+    {
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+
+    while(*p && *p != '\n')
+    {
+        char *end;
+        long first=strtol(p, &end, 10);
+        long last=first;
+
+        if (end==p)
+            return -1;
+        p=end;
+        if (*p == '-')
+        {
+            p++;
+            last=strtol(p, &end, 10);
+            if (end==p)
+                return -1;
+            p=end;
+        }
+        n += last-first+1;
+        if (*p == ',')
+            p++;
+    }
+    return (n>0) ? n : -1;
+}
+
+/* apply the cgroup limits of directory dir */
+static void capacity_cgroup_dir(capacity *c, const char *dir)
+{
+    char filename[MAXPATHLEN];
+    char quota[64];
+    long long period, val;
+    char note[128];
+    FILE *in;
+
+    /* cpu.max: 'max 100000' or 'quota period' */
+    snprintf(filename, MAXPATHLEN, "%s/cpu.max", dir);
+    in=fopen(filename, "r");
+    if (in)
+    {
+        if (fscanf(in, "%63s %lld", quota, &period) == 2 && 
+            strcmp(quota, "max") != 0 && period > 0)
+        {
+            /* a partial cpu still counts as one */
+            int ncpu=(int)((atoll(quota) + period - 1)/period);
+
+            if (ncpu < 1)
+                ncpu=1;
+            if (ncpu < c->ncpu)
+            {
+                c->ncpu=ncpu;
+                snprintf(note, sizeof(note), "cgroup cpu.max %s/%lld", 
+                         quota, period);
+                capacity_note(c, note);
+            }
+        }
+        fclose(in);
+    }
+
+    /* memory.max: 'max' or bytes */
+    snprintf(filename, MAXPATHLEN, "%s/memory.max", dir);
+    in=fopen(filename, "r");
+    if (in)
+    {
+        if (fscanf(in, "%lld", &val) == 1 && (c->mem == 0 || val < c->mem))
+        {
+            c->mem=val;
+            snprintf(note, sizeof(note), "cgroup memory.max %lld MB", 
+                     val/(1024*1024));
+            capacity_note(c, note);
+        }
+        fclose(in);
+    }
+}
+
+void capacity_detect(capacity *c)
+{
+    char note[128];
+    char *cg;
+    long pages, pagesize;
+#ifdef CPU_COUNT
+    cpu_set_t set;
+#endif
+
+    c->reason[0]=0;
+#if defined(_SC_NPROCESSORS_ONLN)
+    c->ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+#elif defined(_SC_NPROC_ONLN)
+    c->ncpu=sysconf(_SC_NPROC_ONLN);
+#elif defined(_SC_NPROCESSORS_CONF)
+    c->ncpu=sysconf(_SC_NPROCESSORS_CONF);
+#elif defined(_SC_NPROC_CONF)
+    c->ncpu=sysconf(_SC_NPROC_CONF);
+#else
+    c->ncpu=1;
+#endif
+    if (c->ncpu < 1)
+        c->ncpu=1;
+    snprintf(note, sizeof(note), "%d online cpus", c->ncpu);
+    capacity_note(c, note);
+
+    c->mem=0;
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    pages=sysconf(_SC_PHYS_PAGES);
+    pagesize=sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pagesize > 0)
+    {
+        c->mem=(long long)pages*pagesize;
+        snprintf(note, sizeof(note), "%lld MB memory", c->mem/(1024*1024));
+        capacity_note(c, note);
+    }
+#else
+    (void)pages;
+    (void)pagesize;
+#endif
+
+#ifdef CPU_COUNT
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && 
+        CPU_COUNT(&set) < c->ncpu)
+    {
+        c->ncpu=CPU_COUNT(&set);
+        snprintf(note, sizeof(note), "affinity mask of %d cpus", c->ncpu);
+        capacity_note(c, note);
+    }
+#endif
+
+    cg=cgroup_find_own();
+    if (cg)
+    {
+        char filename[MAXPATHLEN];
+        char *slash;
+        int ncpu;
+
+        /* the effective cpuset already includes that of the parents */
+        snprintf(filename, MAXPATHLEN, "%s/cpuset.cpus.effective", cg);
+        ncpu=capacity_count_cpuset(filename);
+        if (ncpu > 0 && ncpu < c->ncpu)
+        {
+            c->ncpu=ncpu;
+            snprintf(note, sizeof(note), "cgroup cpuset of %d cpus", ncpu);
+            capacity_note(c, note);
+        }
+        /* the limits of all the parents apply too */
+        do
+        {
+            capacity_cgroup_dir(c, cg);
+            slash=strrchr(cg, '/');
+            if (slash)
+                *slash=0;
+        } while(slash && cg[0]);
+        free(cg);
+    }
+}
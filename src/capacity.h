@@ -0,0 +1,48 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __CAPACITY_H__
+#define __CAPACITY_H__
+
+#define CAPACITY_REASON_LEN 256
+
+/* the resources that are available to jobs, as far as we can tell */
+typedef struct capacity
+{
+    int ncpu; /* the number of cpus */
+    long long mem; /* the memory in bytes, or 0 if unknown */
+    char reason[CAPACITY_REASON_LEN]; /* how these were found */
+} capacity;
+
+/* find out the capacity from the online cpus, our affinity mask, and the 
+   cpu.max, cpuset and memory.max of our cgroup and its parents. */
+void capacity_detect(capacity *c);
+
+#endif /* __CAPACITY_H__ */
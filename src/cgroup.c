@@ -0,0 +1,360 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "err.h"
+#include "cgroup.h"
+
+/* the most we append to the path of our own cgroup: the tree, a job's 
+   cgroup and a file in it, as in '/suq.pid/job.id/cgroup.subtree_control'.
+   The paths we make from it then always fit in MAXPATHLEN. */
+#define CGROUP_SUFFIX_MAX 64
+
+/* write a string to file name in directory dir. Returns 0 on success. */
+static int cgroup_write(const char *dir, const char *name, const char *val)
+{
+    char filename[MAXPATHLEN];
+    int fd;
+    ssize_t len=strlen(val);
+    ssize_t ret;
+
+    snprintf(filename, MAXPATHLEN, "%s/%s", dir, name);
+    fd=open(filename, O_WRONLY|O_CLOEXEC);
+    if (fd<0)
+        return -1;
+    ret=write(fd, val, len);
+    close(fd);
+    return (ret==len) ? 0 : -1;
+}
+
+/* find the value of key in a file with 'key value' lines. Returns 0 if 
+   found. */
+static int cgroup_read_key(const char *dir, const char *name, 
+                           const char *key, long long *val)
+{
+    char filename[MAXPATHLEN];
+    char k[64];
+    long long v;
+    FILE *in;
+    int ret=-1;
+
+    snprintf(filename, MAXPATHLEN, "%s/%s", dir, name);
+    in=fopen(filename, "r");
+    if (!in)
+        return -1;
+    while(fscanf(in, "%63s %lld", k, &v) == 2)
+    {
+        if (strcmp(k, key)==0)
+        {
+            *val=v;
+            ret=0;
+            break;
+        }
+    }
+    fclose(in);
+    return ret;
+}
+
+/* check whether controller ctrl is in the list in file name in dir */
+static int cgroup_has_controller(const char *dir, const char *name,
+                                 const char *ctrl)
+{
+    char filename[MAXPATHLEN];
+    char c[64];
+    FILE *in;
+    int ret=0;
+
+    snprintf(filename, MAXPATHLEN, "%s/%s", dir, name);
+    in=fopen(filename, "r");
+    if (!in)
+        return 0;
+    while(fscanf(in, "%63s", c) == 1)
+    {
+        if (strcmp(c, ctrl)==0)
+        {
+            ret=1;
+            break;
+        }
+    }
+    fclose(in);
+    return ret;
+}
+
+char *cgroup_find_own(void)
+{
+    char line[MAXPATHLEN*2];
+    char mountpoint[MAXPATHLEN];
+    char path[MAXPATHLEN];
+    char *ret;
+    FILE *in;
+    int found=0;
+
+    /* the cgroup2 mount: 'id parent dev root mountpoint opts ... - type' */
+    in=fopen("/proc/self/mountinfo", "r");
+    if (!in)
+        return NULL;
+    while(fgets(line, sizeof(line), in))
+    {
+        char *sep=strstr(line, " - cgroup2 ");
+
+        if (sep && sscanf(line, "%*s %*s %*s %*s %4095s", mountpoint)==1)
+        {
+            found=1;
+            break;
+        }
+    }
+    fclose(in);
+    if (!found)
+        return NULL;
+
+    /* our cgroup, in the '0::/path' line */
+    found=0;
+    in=fopen("/proc/self/cgroup", "r");
+    if (!in)
+        return NULL;
+    while(fgets(line, sizeof(line), in))
+    {
+        if (strncmp(line, "0::", 3)==0)
+        {
+            char *nl=strchr(line, '\n');
+            if (nl)
+                *nl=0;
+            /* a path we can't hold is as good as none */
+            found=(snprintf(path, MAXPATHLEN, "%s", line+3) < MAXPATHLEN);
+            break;
+        }
+    }
+    fclose(in);
+    if (!found)
+        return NULL;
+
+    ret=malloc_check_server(MAXPATHLEN);
+    if (snprintf(ret, MAXPATHLEN, "%s%s", mountpoint, 
+                 (strcmp(path, "/")==0) ? "" : path) >= MAXPATHLEN)
+    {
+        free(ret);
+        return NULL;
+    }
+    return ret;
+}
+
+void cgroup_tree_init(cgroup_tree *ct)
+{
+    char *own;
+    char daemon[MAXPATHLEN];
+
+    ct->top=NULL;
+    ct->orig=NULL;
+    ct->cpu=0;
+    ct->memory=0;
+
+    own=cgroup_find_own();
+    if (!own)
+        return;
+    if (strlen(own) + CGROUP_SUFFIX_MAX >= MAXPATHLEN)
+    {
+        if (debug>0)
+            printf("SERVER: cgroup path %s is too long; not using cgroups\n",
+                   own);
+        free(own);
+        return;
+    }
+    snprintf(daemon, MAXPATHLEN, "%s/cgroup.procs", own);
+    if (access(own, W_OK) || access(daemon, W_OK))
+    {
+        if (debug>0)
+            printf("SERVER: cgroup %s is not writable; not using cgroups\n",
+                   own);
+        free(own);
+        return;
+    }
+
+    ct->top=malloc_check_server(MAXPATHLEN);
+    snprintf(ct->top, MAXPATHLEN, "%s/suq.%d", own, (int)getpid());
+    if (mkdir(ct->top, S_IRWXU) < 0)
+    {
+        server_system_error("mkdir of job cgroup tree");
+        free(ct->top);
+        ct->top=NULL;
+        free(own);
+        return;
+    }
+    /* processes can only be in leaves, so we get a leaf of our own */
+    snprintf(daemon, MAXPATHLEN, "%s/daemon", ct->top);
+    if (mkdir(daemon, S_IRWXU) < 0 || cgroup_enter(daemon, getpid()) < 0)
+    {
+        server_system_error("moving into our own cgroup");
+        rmdir(daemon);
+        rmdir(ct->top);
+        free(ct->top);
+        ct->top=NULL;
+        free(own);
+        return;
+    }
+    ct->orig=own;
+
+    /* enable the controllers where we can. That only works if nothing 
+       else is left in our original cgroup, or they were enabled already.*/
+    cgroup_write(own, "cgroup.subtree_control", "+cpu");
+    cgroup_write(own, "cgroup.subtree_control", "+memory");
+    cgroup_write(ct->top, "cgroup.subtree_control", "+cpu");
+    cgroup_write(ct->top, "cgroup.subtree_control", "+memory");
+    ct->cpu=cgroup_has_controller(ct->top, "cgroup.subtree_control", "cpu");
+    ct->memory=cgroup_has_controller(ct->top, "cgroup.subtree_control", 
+                                     "memory");
+    printf("SERVER: using cgroup %s (cpu controller: %s, memory controller: "
+           "%s)\n", ct->top, ct->cpu ? "yes" : "no", 
+           ct->memory ? "yes" : "no");
+}
+
+void cgroup_tree_destroy(cgroup_tree *ct)
+{
+    char daemon[MAXPATHLEN];
+
+    if (!ct->top)
+        return;
+    cgroup_enter(ct->orig, getpid());
+    snprintf(daemon, MAXPATHLEN, "%s/daemon", ct->top);
+    rmdir(daemon);
+    rmdir(ct->top);
+    free(ct->top);
+    free(ct->orig);
+    ct->top=NULL;
+    ct->orig=NULL;
+}
+
+char *cgroup_create(cgroup_tree *ct, int id, int ntask, long long mem_max)
+{
+    char *path;
+    char val[64];
+
+    if (!ct->top)
+        return NULL;
+
+    path=malloc_check_server(MAXPATHLEN);
+    snprintf(path, MAXPATHLEN, "%s/job.%d", ct->top, id);
+    if (mkdir(path, S_IRWXU) < 0 && errno != EEXIST)
+    {
+        server_system_error("mkdir of job cgroup");
+        free(path);
+        return NULL;
+    }
+    if (ct->cpu && ntask > 0)
+    {
+        /* ntask cpus' worth of time in every period of 100 ms */
+        snprintf(val, sizeof(val), "%d 100000", ntask*100000);
+        if (cgroup_write(path, "cpu.max", val) < 0)
+            server_system_error("setting cpu.max");
+    }
+    if (ct->memory && mem_max > 0)
+    {
+        snprintf(val, sizeof(val), "%lld", mem_max);
+        if (cgroup_write(path, "memory.max", val) < 0)
+            server_system_error("setting memory.max");
+    }
+    return path;
+}
+
+int cgroup_enter(const char *path, pid_t pid)
+{
+    char pidstr[32];
+
+    snprintf(pidstr, sizeof(pidstr), "%d", (int)pid);
+    return cgroup_write(path, "cgroup.procs", pidstr);
+}
+
+int cgroup_populated(const char *path)
+{
+    long long val;
+
+    if (cgroup_read_key(path, "cgroup.events", "populated", &val) < 0)
+        return -1;
+    return (val != 0);
+}
+
+void cgroup_read_stat(const char *path, cgroup_stat *cs)
+{
+    long long val;
+
+    cs->valid=0;
+    cs->usage_usec=cs->user_usec=cs->system_usec=0;
+    cs->mem_peak=-1;
+    cs->oom_kills=0;
+    /* cpu.stat is always there */
+    if (cgroup_read_key(path, "cpu.stat", "usage_usec", &val) < 0)
+        return;
+    cs->valid=1;
+    cs->usage_usec=val;
+    if (cgroup_read_key(path, "cpu.stat", "user_usec", &val) == 0)
+        cs->user_usec=val;
+    if (cgroup_read_key(path, "cpu.stat", "system_usec", &val) == 0)
+        cs->system_usec=val;
+    /* these only with the memory controller */
+    if (cgroup_read_key(path, "memory.events", "oom_kill", &val) == 0)
+        cs->oom_kills=(int)val;
+    {
+        char filename[MAXPATHLEN];
+        FILE *in;
+
+        snprintf(filename, MAXPATHLEN, "%s/memory.peak", path);
+        in=fopen(filename, "r");
+        if (in)
+        {
+            if (fscanf(in, "%lld", &val) == 1)
+                cs->mem_peak=val;
+            fclose(in);
+        }
+    }
+}
+
+int cgroup_kill(const char *path)
+{
+    return cgroup_write(path, "cgroup.kill", "1");
+}
+
+void cgroup_remove(const char *path)
+{
+    if (rmdir(path) < 0 && errno != ENOENT && debug>0)
+        printf("SERVER: couldn't remove cgroup %s: %s\n", path, 
+               strerror(errno));
+}
@@ -0,0 +1,90 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __CGROUP_H__
+#define __CGROUP_H__
+
+#include <sys/types.h>
+
+/* the cgroup v2 subtree that we put jobs in. We create a directory 
+   suq.<pid> in our own cgroup, move ourselves into a leaf 'daemon' under it,
+   and give every job its own cgroup next to that. */
+typedef struct cgroup_tree
+{
+    char *top; /* our subtree, or NULL if we have none */
+    char *orig; /* the cgroup we started in */
+    int cpu; /* whether the cpu controller is enabled for jobs */
+    int memory; /* whether the memory controller is enabled for jobs */
+} cgroup_tree;
+
+/* the accounting of a job cgroup */
+typedef struct cgroup_stat
+{
+    int valid; /* whether it was read */
+    long long usage_usec; /* total cpu time */
+    long long user_usec; /* user cpu time */
+    long long system_usec; /* system cpu time */
+    long long mem_peak; /* the peak memory usage in bytes, or -1 */
+    int oom_kills; /* the number of processes killed by the OOM killer */
+} cgroup_stat;
+
+
+/* find our cgroup v2 directory from the mount table and /proc/self/cgroup.
+   Returns an allocated path, or NULL. */
+char *cgroup_find_own(void);
+
+/* find a writable cgroup v2 subtree and set it up. Without one, the
+   tree's top is NULL and jobs get no cgroups. */
+void cgroup_tree_init(cgroup_tree *ct);
+
+/* move ourselves back and remove the subtree */
+void cgroup_tree_destroy(cgroup_tree *ct);
+
+/* create the cgroup for job id, limiting it to ntask cpus and mem_max bytes
+   (if > 0) where possible. Returns its (allocated) path, or NULL. */
+char *cgroup_create(cgroup_tree *ct, int id, int ntask, long long mem_max);
+
+/* move process pid into cgroup path. Returns 0 on success. */
+int cgroup_enter(const char *path, pid_t pid);
+
+/* check whether there are processes in cgroup path. Returns 1 if there are,
+   0 if not, and -1 if that can't be determined. */
+int cgroup_populated(const char *path);
+
+/* read the accounting of cgroup path */
+void cgroup_read_stat(const char *path, cgroup_stat *cs);
+
+/* kill all processes in cgroup path. Returns 0 on success. */
+int cgroup_kill(const char *path);
+
+/* remove the (empty) cgroup path */
+void cgroup_remove(const char *path);
+
+#endif /* __CGROUP_H__ */
@@ -48,6 +48,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <paths.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <sys/file.h>
 
 
 
@@ -55,16 +58,16 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "settings.h"
 #include "client_conn.h"
 #include "server.h"
+#include "protocol.h"
 
 extern char **environ;
 
-void client_connection_init(client_connection *cc, suq_settings *st)
+/* try to connect to a listening server. Returns the socket, or -1 */
+static int client_try_connect(suq_settings *st)
 {
     int sockdes;
     struct sockaddr_un server_addr;
-    int connres;
 
-    /* first try to connect to a listening server */
     sockdes=socket(AF_UNIX, SOCK_STREAM, 0);
     if (sockdes < 0)
         fatal_system_error("Opening socket");
@@ -76,94 +79,148 @@ void client_connection_init(client_connection *cc, suq_settings *st)
     server_addr.sun_family = AF_UNIX;
     strncpy(server_addr.sun_path, st->sock_filename, 
             sizeof(server_addr.sun_path));
-    if ((connres=connect(sockdes, (const struct sockaddr*)&server_addr, 
-                SUN_LEN(&server_addr)))>=0)
+    if (connect(sockdes, (const struct sockaddr*)&server_addr, 
+                SUN_LEN(&server_addr)) < 0)
     {
-        /* we're connected to a server */
         if (debug>0)
-            printf("CLIENT: Connecting to existing server\n");
-        cc->fd_read=sockdes;
-        cc->fd_write=sockdes;
+            printf("CLIENT: No server. Error was '%s'\n", strerror(errno));
+        close(sockdes);
+        return -1;
     }
-    else
+    /* we're connected to a server */
+    if (debug>0)
+        printf("CLIENT: Connecting to existing server\n");
+    return sockdes;
+}
+
+/* try to take the server lock. Returns its file descriptor, or -1 if 
+   another server has it. */
+static int client_take_lock(suq_settings *st)
+{
+    int fd;
+
+    fd=open(st->lock_filename, O_RDWR|O_CREAT|O_CLOEXEC, S_IRUSR|S_IWUSR);
+    if (fd < 0)
+        fatal_system_error("Opening the server lock file");
+    if (flock(fd, LOCK_EX|LOCK_NB) < 0)
     {
-        /* there was no server. We fork with two pipe pairs for
-           immediate communication. */
-        int fdes_inp[2]; /* input pipe pair from server */
-        int fdes_out[2]; /* output pipe pair to server  */
-        int pid;
-        char *logname=st->log_filename;
-        int stdo; /* the stdout replacement file */
-        int stdi; /* the stdin replacement file */
+        if (errno != EWOULDBLOCK)
+            fatal_system_error("Locking the server lock file");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-        if (debug>0)
-            printf("CLIENT: No server, spawning new one. Error was '%s'\n",
-                   strerror(errno));
-
-        if (sockdes > 0)
-            close(sockdes);
-        /* open pipe pairs*/
-        if (pipe(fdes_out)<0)
-            fatal_system_error("cs queuer pipe creation");
-        if (pipe(fdes_inp)<0)
-            fatal_system_error("cs queuer pipe creation");
-
-        /* open the log file name */
-        stdo=open(logname, O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
-        if (stdo<0)
-            fatal_system_error("cs queuer log file");
-        stdi=open("/dev/null", O_RDONLY);
-        if (stdi<0)
-            fatal_system_error("cs queuer stdin file");
-
-        pid=fork();
-        if (pid<0)
-            fatal_system_error("cs queuer fork");
-
-        if (pid==0)
+/* spawn a new server that takes over lock_fd, and talk to it over a
+   socket pair */
+static void client_spawn_server(client_connection *cc, suq_settings *st,
+                                int lock_fd)
+{
+    /* We fork with a socket pair for immediate communication; unlike 
+       pipes, it can pass file descriptors. */
+    int fdes[2]; /* our end, and the server's */
+    int pid;
+    char *logname=st->log_filename;
+    int stdo; /* the stdout replacement file */
+    int stdi; /* the stdin replacement file */
+
+    if (debug>0)
+        printf("CLIENT: spawning new server\n");
+
+    /* open the socket pair */
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fdes)<0)
+        fatal_system_error("cs queuer socket pair creation");
+
+    /* open the log file name */
+    stdo=open(logname, O_WRONLY|O_CREAT|O_APPEND, S_IRUSR|S_IWUSR);
+    if (stdo<0)
+        fatal_system_error("cs queuer log file");
+    stdi=open("/dev/null", O_RDONLY);
+    if (stdi<0)
+        fatal_system_error("cs queuer stdin file");
+
+    pid=fork();
+    if (pid<0)
+        fatal_system_error("cs queuer fork");
+
+    if (pid==0)
+    {
+        /* I am now almost the server; we fork again to have no parent. */
+        int ret=fork();
+
+        if (ret==0)
         {
-            /* I am now almost the server; we fork again to have no parent. */
-            int ret=fork();
+            /* I am the server. */
+            close(fdes[0]); /* the client's end */
 
-            if (ret==0)
-            {
-                /* I am the server. */
-                close(fdes_inp[0]); /* input from server is now output for server */
-                close(fdes_out[1]); /* output to server is now input for server */
-
-                /* we go to the root dir because we're now a daemon */
-                if (chdir("/") < 0)
-                    fatal_system_error("chdir to / failed");
-
-                /* we try to become a new session leader */
-                ignore_error(setsid());
-
-                /* take care of the stdin/out/err files */
-                close(STDOUT_FILENO);
-                dup2(stdo, STDOUT_FILENO);
-                close(STDERR_FILENO);
-                dup2(stdo, STDERR_FILENO);
-                close(STDIN_FILENO);
-                dup2(stdi, STDIN_FILENO);
-                close(stdi);
-                close(stdo);
-
-
-                /* main loop of the server. Potentially never returns. */
-                suq_serv_main(st, fdes_out[0], fdes_inp[1]); 
-            }
-            exit(0);
+            /* we go to the root dir because we're now a daemon */
+            if (chdir("/") < 0)
+                fatal_system_error("chdir to / failed");
+
+            /* we try to become a new session leader */
+            ignore_error(setsid());
+
+            /* take care of the stdin/out/err files */
+            close(STDOUT_FILENO);
+            dup2(stdo, STDOUT_FILENO);
+            close(STDERR_FILENO);
+            dup2(stdo, STDERR_FILENO);
+            close(STDIN_FILENO);
+            dup2(stdi, STDIN_FILENO);
+            close(stdi);
+            close(stdo);
+
+
+            /* main loop of the server. Potentially never returns. */
+            suq_serv_main(st, lock_fd, fdes[1], fdes[1]); 
         }
-        else
+        exit(0);
+    }
+    else
+    {
+        /* I am still the client. The server holds the lock now. */
+        close(fdes[1]);
+        close(stdo);
+        close(stdi);
+        close(lock_fd);
+        cc->fd_read=fdes[0];
+        cc->fd_write=fdes[0];
+    }
+}
+
+void client_connection_init(client_connection *cc, suq_settings *st)
+{
+    int sockdes;
+    long wait_us=CLIENT_WAIT_MIN_US; /* the time until we try again */
+    long waited_us=0;
+
+    /* first try to connect to a listening server */
+    while( (sockdes=client_try_connect(st)) < 0)
+    {
+        /* there was no server. Of the clients that find that at the same 
+           time, the one that gets the lock starts one; the others wait for
+           it to listen. The lock is held by a server for as long as it has
+           the socket. */
+        int lock_fd=client_take_lock(st);
+
+        if (lock_fd >= 0)
         {
-            /* I am still the client */
-            close(fdes_inp[1]);
-            close(fdes_out[0]);
-            cc->fd_read=fdes_inp[0];
-            cc->fd_write=fdes_out[1];
+            client_spawn_server(cc, st, lock_fd);
+            return;
         }
+        if (waited_us >= CLIENT_WAIT_MAX_US)
+            fatal_error("The queuer that is starting doesn't answer");
+        if (debug>0)
+            printf("CLIENT: a server is starting; waiting %ld us\n", wait_us);
+        usleep(wait_us);
+        waited_us += wait_us;
+        wait_us *= 2;
+        if (wait_us > CLIENT_WAIT_STEP_MAX_US)
+            wait_us=CLIENT_WAIT_STEP_MAX_US;
     }
-
+    cc->fd_read=sockdes;
+    cc->fd_write=sockdes;
     /* now we have a working client_connection */
 }
 
@@ -177,113 +234,569 @@ void client_connection_destroy(client_connection *cc)
     close(cc->fd_read);
 }
 
+/* print to stdout, for the snapshot formatters */
+static void client_snapshot_vprintf(void *ctx, const char *fmt, va_list ap)
+{
+    vfprintf((FILE*)ctx, fmt, ap);
+}
+
+int client_snapshot_print(suq_settings *st, int argc, char *argv[])
+{
+    snapshot s;
+    int search_id=0;
+    int ret=0;
+    int list;
+
+    if (argc < 2 || !st->snap_filename)
+        return 0;
+    list=(strcmp(argv[1], "ls")==0 || strcmp(argv[1], "list")==0);
+    if (list)
+    {
+        if (argc != 2)
+            return 0;
+    }
+    else if (strcmp(argv[1], "info")==0 && argc == 3)
+    {
+        char *end;
+        if (strcmp(argv[2], "all")==0)
+            search_id=-1;
+        else
+        {
+            search_id=strtol(argv[2], &end, 10);
+            /* let the daemon complain */
+            if (end==argv[2] || *end != 0)
+                return 0;
+        }
+    }
+    else
+        return 0;
+
+    if (snapshot_read(st->snap_filename, st->lock_filename, &s) != 0)
+    {
+        if (debug>1) 
+            printf("CLIENT: no snapshot in %s\n", st->snap_filename);
+        return 0;
+    }
+    if (list)
+    {
+        snapshot_print_list(&s, client_snapshot_vprintf, stdout);
+        ret=1;
+    }
+    else
+    {
+        /* print nothing until we know the job is there */
+        if (search_id == -1 || snapshot_print_info(&s, search_id, NULL, NULL))
+        {
+            snapshot_print_info(&s, search_id, client_snapshot_vprintf, 
+                                stdout);
+            ret=1;
+        }
+    }
+    snapshot_free(&s);
+    return ret;
+}
+
+/* get the file name given with the -o option of a run command, or NULL. 
+   The options are those that request_run() takes. */
+static const char *client_run_output(int argc, char *argv[])
+{
+    int i;
+
+    if (argc < 2 || (strcmp(argv[1], "run")!=0 && strcmp(argv[1], "sub")!=0))
+        return NULL;
+    for(i=2;i<argc;i++)
+    {
+        if (strcmp(argv[i], "-o")==0)
+            return (i+1 < argc) ? argv[i+1] : NULL;
+        if (strcmp(argv[i], "-d")==0 || strcmp(argv[i], "-n")==0 || 
+            strcmp(argv[i], "-p")==0 || strcmp(argv[i], "-m")==0 || 
+            strcmp(argv[i], "-t")==0)
+            i++;
+        else if (strcmp(argv[i], "-b")!=0 && strcmp(argv[i], "-s")!=0 &&
+                 strcmp(argv[i], "-E")!=0)
+            break; /* the command */
+    }
+    return NULL;
+}
+
+/* write buf to fd, passing the nfds file descriptors in fds along with its
+   first byte */
+static void client_connection_write(int fd, const char *buf, size_t len,
+                                    const int *fds, int nfds)
+{
+    size_t cursor=0;
+
+    while(cursor < len)
+    {
+        ssize_t ret;
+
+        if (nfds > 0)
+        {
+            struct msghdr msg;
+            struct iovec iov;
+            union
+            {
+                char buf[CMSG_SPACE(sizeof(int)*PROTO_MAX_FDS)];
+                struct cmsghdr align;
+            } ctl;
+            struct cmsghdr *cmsg;
+
+            iov.iov_base=(char*)buf + cursor;
+            iov.iov_len=len - cursor;
+            memset(&msg, 0, sizeof(msg));
+            memset(&ctl, 0, sizeof(ctl));
+            msg.msg_iov=&iov;
+            msg.msg_iovlen=1;
+            msg.msg_control=ctl.buf;
+            msg.msg_controllen=CMSG_SPACE(sizeof(int)*nfds);
+            cmsg=CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level=SOL_SOCKET;
+            cmsg->cmsg_type=SCM_RIGHTS;
+            cmsg->cmsg_len=CMSG_LEN(sizeof(int)*nfds);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int)*nfds);
+
+            ret=sendmsg(fd, &msg, 0);
+            if (ret < 0 && errno == ENOTSOCK)
+            {
+                /* the queuer uses the paths instead */
+                nfds=0;
+                continue;
+            }
+        }
+        else
+        {
+            ret=write(fd, buf+cursor, len-cursor);
+        }
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fatal_system_error("server write");
+        }
+        /* the fds went with the first byte */
+        nfds=0;
+        cursor += ret;
+    }
+}
+
 void client_connection_send_request(client_connection *sc, int argc, 
                                     char *argv[])
 {
-    char *buf=NULL;
-    size_t needed=0;
-    size_t cursor=0;
+    proto_frame pf;
+    char wd[MAXPATHLEN+1];
+    int fds[PROTO_MAX_FDS];
+    int nfds=0;
+    const char *out=client_run_output(argc, argv);
     int i;
 
+    proto_frame_init(&pf, 0);
+
+    /* first we have the current working directory */
+    if (! getcwd(wd, MAXPATHLEN) )
+        fatal_system_error("getcwd");
+    proto_frame_add_string(&pf, PROTO_FIELD_WD, wd);
+
+    /* a job runs in the directory we pass, so the queuer doesn't need to
+       look it up again, and writes to the output file we opened */
+    if (argc > 1 && (strcmp(argv[1], "run")==0 || strcmp(argv[1], "sub")==0))
+    {
+#ifdef O_PATH
+        int wd_fd=open(".", O_PATH|O_DIRECTORY|O_CLOEXEC);
+#else
+        int wd_fd=open(".", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+#endif
+        if (wd_fd >= 0)
+        {
+            fds[nfds++]=wd_fd;
+            proto_frame_add_string(&pf, PROTO_FIELD_WD_FD, "");
+        }
+    }
+    if (out)
+    {
+        int out_fd=open(out, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 
+                        S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+        if (out_fd < 0)
+            fatal_system_error(out);
+        fds[nfds++]=out_fd;
+        proto_frame_add_string(&pf, PROTO_FIELD_OUT_FD, "");
+    }
+
+    /* then, the arguments */
     for(i=0; i<argc; i++)
-        needed += strlen(argv[i])+1;
-    i=0;
-    needed++; /* for the nul separator */
-    while(environ[i])
+        proto_frame_add_string(&pf, PROTO_FIELD_ARG, argv[i]);
+
+    /* and finally, the environment */
+    for(i=0; environ[i]; i++)
+        proto_frame_add_string(&pf, PROTO_FIELD_ENV, environ[i]);
+
+    proto_frame_finish(&pf);
+
+    client_connection_write(sc->fd_write, pf.buf, pf.len, fds, nfds);
+    for(i=0;i<nfds;i++)
+        close(fds[i]);
+    proto_frame_destroy(&pf);
+}
+
+void client_connection_get_print_results(client_connection *sc, int *errcode)
+{
+    char buf[CLIENT_CONN_BUF_SIZE];
+    ssize_t ret;
+    int start=1; /* whether we're at the start of a reply */
+    FILE *outfile=stdout;
+
+    *errcode=0;
+    /* replies are nul-terminated strings. There's usually one, but a watch
+       sends one for each event, until the server goes away. */
+    while( (ret=read(sc->fd_read, buf, sizeof(buf))) != 0)
     {
-        needed += strlen(environ[i])+1;
-        i++;
+        char *p=buf;
+
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fatal_system_error("read");
+        }
+        if (debug>1)
+            printf("CLIENT: Read ret=%d\n", (int)ret);
+        while(p < buf + ret)
+        {
+            char *nul=memchr(p, 0, buf + ret - p);
+            size_t len=nul ? (size_t)(nul - p) : (size_t)(buf + ret - p);
+
+            if (start)
+            {
+                /* errors are recognized by their start */
+                if (len >= strlen("ERROR") && 
+                    strncmp(p, "ERROR", strlen("ERROR")) == 0)
+                {
+                    *errcode=1;
+                    outfile=stderr;
+                }
+                else
+                {
+                    outfile=stdout;
+                }
+            }
+            fwrite(p, 1, len, outfile);
+            start=(nul != NULL);
+            p += len + (nul ? 1 : 0);
+        }
+        fflush(outfile);
     }
-    needed++; /* for the nul separator */
-    needed+=MAXPATHLEN+1; /* for the current working directory */
-    needed++; /* for the nul separator */
-    needed+=3; /* for the end double nul separator */
 
-    buf=malloc_check(sizeof(char)*needed);
-    /* first we have the current working directory */
-    if (! getcwd(buf, MAXPATHLEN) )
-        server_system_error("getcwd");
+    close(sc->fd_read);
+}
 
-    cursor=strlen(buf)+1;
-    buf[cursor++]=0;
 
-    /* then, we copy the arguments: */
-    for(i=0; i<argc; i++)
+/* a growing byte buffer for the batch session */
+typedef struct 
+{
+    char *buf;
+    size_t start, len, alloc;
+} batch_buf;
+
+/* how many bytes of requests we let queue up before reading more input */
+#define BATCH_MAX_PENDING (256*1024)
+
+static void batch_buf_append(batch_buf *b, const char *data, size_t len)
+{
+    if (b->start > 0 && b->len + len > b->alloc)
     {
-        int len=strlen(argv[i])+1;
-        strncpy(buf+cursor, argv[i], len);
-        cursor += len;
+        memmove(b->buf, b->buf + b->start, b->len - b->start);
+        b->len -= b->start;
+        b->start=0;
     }
-    buf[cursor++]=0;
-    /* and finally, the environment */
-    i=0;
-    while(environ[i])
+    if (b->len + len > b->alloc)
     {
-        int len=strlen(environ[i])+1;
-        strncpy(buf+cursor, environ[i], len);
-        cursor += len;
-        i++;
+        if (b->alloc == 0)
+            b->alloc=CLIENT_CONN_BUF_SIZE;
+        while(b->len + len > b->alloc)
+            b->alloc *= 2;
+        b->buf=realloc_check(b->buf, b->alloc);
     }
-    buf[cursor++]=0;
-    buf[cursor++]=0;
+    memcpy(b->buf + b->len, data, len);
+    b->len += len;
+}
 
-    if (write(sc->fd_write, buf, cursor) < 0)
-        fatal_system_error("server write");
+/* read what's available from fd into b. Returns the read() result. */
+static ssize_t batch_buf_read(batch_buf *b, int fd)
+{
+    char rbuf[CLIENT_CONN_BUF_SIZE];
+    ssize_t ret;
+
+    ret=read(fd, rbuf, sizeof(rbuf));
+    if (ret > 0)
+        batch_buf_append(b, rbuf, ret);
+    return ret;
 }
 
-void client_connection_get_print_results(client_connection *sc, int *errcode)
+/* split a line into words, in place. Words are separated by white space,
+   and may be quoted with ' or ". A # at the start of a word starts a 
+   comment. Returns the number of words. */
+static int batch_split_line(char *line, char ***words, size_t *nalloc)
 {
-    size_t alloc_size=0;
-    char *buf=NULL;
-    int ret;
-    FILE *outfile;
+    char *in=line, *out=line;
+    int n=0;
 
-    *errcode=0;
-    do
+    for(;;)
     {
-        size_t cursor=0;
-        size_t read_size;
-        if (alloc_size>0)
-            buf[0]=0;
-        do
-        { 
-            /* alocate if needed */
-            if (alloc_size <= cursor)
+        char *start;
+        int more;
+
+        while(*in==' ' || *in=='\t' || *in=='\r')
+            in++;
+        if (*in==0 || *in=='#')
+            break;
+
+        start=out;
+        while(*in && *in!=' ' && *in!='\t' && *in!='\r')
+        {
+            if (*in=='\'' || *in=='"')
             {
-                if (debug>1)
-                    printf("CLIENT: Allocating read buffer\n");
-                alloc_size+=CLIENT_CONN_BUF_SIZE;
-                buf=realloc_check(buf, alloc_size);
+                char quote=*in++;
+                while(*in && *in!=quote)
+                    *out++=*in++;
+                if (*in)
+                    in++;
             }
-            /* do the read */
-            read_size=alloc_size-cursor;
-            ret=read(sc->fd_read, buf+cursor, read_size);
-            if (debug>1)
-                printf("CLIENT: Read ret=%d\n",ret);
-            if (ret < 0)
-                fatal_system_error("read");
-            cursor+=ret;
-        } 
-        while (ret==read_size); /* read as long as there's something to be read */
+            else
+            {
+                *out++=*in++;
+            }
+        }
+        more=(*in != 0);
+        *out=0;
+        if ( (size_t)n+1 >= *nalloc)
+        {
+            *nalloc += 16;
+            *words=realloc_check(*words, sizeof(char*)*(*nalloc));
+        }
+        (*words)[n++]=start;
+        out++;
+        if (more)
+            in++;
+    }
+    return n;
+}
+
+/* make a request frame for a line of input and queue it. Returns 1 if 
+   there was a request, 0 for an empty line. */
+static int batch_add_request(batch_buf *out, char *line, int lineno,
+                             const char *argv0, const char *wd)
+{
+    static char **words=NULL;
+    static size_t nalloc=0;
+    proto_frame pf;
+    char tag[32];
+    int nwords;
+    int i;
 
-        if (strncmp(buf, "ERROR", strlen("ERROR")) == 0)
+    nwords=batch_split_line(line, &words, &nalloc);
+    if (nwords == 0)
+        return 0;
+
+    proto_frame_init(&pf, PROTO_FLAG_SESSION);
+    proto_frame_add_string(&pf, PROTO_FIELD_WD, wd);
+    snprintf(tag, sizeof(tag), "%d", lineno);
+    proto_frame_add_string(&pf, PROTO_FIELD_TAG, tag);
+    proto_frame_add_string(&pf, PROTO_FIELD_ARG, argv0);
+    for(i=0; i<nwords; i++)
+        proto_frame_add_string(&pf, PROTO_FIELD_ARG, words[i]);
+    /* only jobs need the environment */
+    if (strcmp(words[0], "run")==0 || strcmp(words[0], "sub")==0)
+    {
+        for(i=0; environ[i]; i++)
+            proto_frame_add_string(&pf, PROTO_FIELD_ENV, environ[i]);
+    }
+    proto_frame_finish(&pf);
+
+    batch_buf_append(out, pf.buf, pf.len);
+    proto_frame_destroy(&pf);
+    return 1;
+}
+
+/* print the text of a reply, with the tag in front of each line if 
+   show_tags is set */
+static void batch_print_reply(FILE *outfile, const char *tag, 
+                              const char *text, int show_tags)
+{
+    if (!show_tags || !tag)
+    {
+        fprintf(outfile, "%s", text);
+        return;
+    }
+    while(*text)
+    {
+        const char *end=strchr(text, '\n');
+        int len=end ? (int)(end - text) : (int)strlen(text);
+
+        fprintf(outfile, "%s: %.*s\n", tag, len, text);
+        text += len;
+        if (*text)
+            text++;
+    }
+}
+
+/* handle the complete reply frames in b. Returns the number of final 
+   replies. */
+static int batch_handle_replies(batch_buf *b, int show_tags, int *errcode)
+{
+    int nfinal=0;
+
+    for(;;)
+    {
+        const char *frame=b->buf + b->start;
+        size_t avail=b->len - b->start;
+        size_t frame_len;
+        size_t pos=0;
+        int type;
+        const char *value;
+        size_t len;
+        const char *tag=NULL;
+        const char *text="";
+        int flags;
+        int ret;
+
+        if (avail == 0)
+            break;
+        if (proto_frame_check(frame, avail, &frame_len) < 0)
+            fatal_error("unexpected reply from the queuer");
+        if (frame_len == 0 || frame_len > avail)
+            break;
+
+        flags=proto_frame_flags(frame);
+        while( (ret=proto_frame_next_field(frame, frame_len, &pos, &type, 
+                                           &value, &len)) > 0)
+        {
+            if (len == 0 || value[len-1] != 0)
+                continue;
+            if (type == PROTO_FIELD_TAG)
+                tag=value;
+            else if (type == PROTO_FIELD_TEXT)
+                text=value;
+        }
+        if (ret < 0)
+            fatal_error("malformed reply from the queuer");
+
+        if (flags & PROTO_FLAG_ERROR)
         {
             *errcode=1;
-            outfile=stderr;
+            batch_print_reply(stderr, tag, text, show_tags);
         }
         else
         {
-            outfile=stdout;
+            batch_print_reply(stdout, tag, text, show_tags);
         }
-        fprintf(outfile, "%s", buf);
+        if (! (flags & PROTO_FLAG_PARTIAL))
+            nfinal++;
+
+        b->start += frame_len;
     }
-    while (ret>0);
+    fflush(stdout);
+    return nfinal;
+}
 
-    free(buf);
+void client_connection_batch(client_connection *cc, const char *argv0,
+                             int show_tags, int *errcode)
+{
+    batch_buf in={NULL, 0, 0, 0}; /* from stdin */
+    batch_buf out={NULL, 0, 0, 0}; /* to the queuer */
+    batch_buf replies={NULL, 0, 0, 0}; /* from the queuer */
+    char wd[MAXPATHLEN+1];
+    int stdin_open=1;
+    long outstanding=0;
+    int lineno=0;
 
-    close(sc->fd_read);
-}
+    *errcode=0;
+    if (! getcwd(wd, MAXPATHLEN) )
+        fatal_system_error("getcwd");
 
+    /* we never want to block on sending while the replies pile up */
+    if (fcntl(cc->fd_write, F_SETFL, 
+              fcntl(cc->fd_write, F_GETFL) | O_NONBLOCK) < 0)
+        fatal_system_error("fcntl");
 
+    while(stdin_open || out.len > out.start || outstanding > 0)
+    {
+        struct pollfd pfd[3];
+        int n_stdin=-1, n_write=-1, n_read;
+        int n=0;
 
+        if (stdin_open && (out.len - out.start) < BATCH_MAX_PENDING)
+        {
+            pfd[n].fd=STDIN_FILENO;
+            pfd[n].events=POLLIN;
+            n_stdin=n++;
+        }
+        if (out.len > out.start)
+        {
+            pfd[n].fd=cc->fd_write;
+            pfd[n].events=POLLOUT;
+            n_write=n++;
+        }
+        pfd[n].fd=cc->fd_read;
+        pfd[n].events=POLLIN;
+        n_read=n++;
+
+        if (poll(pfd, n, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            fatal_system_error("poll");
+        }
+
+        if (n_stdin >= 0 && pfd[n_stdin].revents)
+        {
+            ssize_t ret=batch_buf_read(&in, STDIN_FILENO);
+            char *nl;
+
+            if (ret < 0 && errno != EINTR && errno != EAGAIN)
+                fatal_system_error("read from stdin");
+            if (ret == 0)
+            {
+                /* the last line may not have a newline */
+                stdin_open=0;
+                batch_buf_append(&in, "\n", 1);
+            }
+            while( (nl=memchr(in.buf + in.start, '\n', in.len - in.start)) )
+            {
+                *nl=0;
+                lineno++;
+                outstanding += batch_add_request(&out, in.buf + in.start,
+                                                 lineno, argv0, wd);
+                in.start = (nl + 1) - in.buf;
+            }
+        }
+        if (n_write >= 0 && pfd[n_write].revents)
+        {
+            ssize_t ret=write(cc->fd_write, out.buf + out.start, 
+                              out.len - out.start);
+            if (ret < 0 && errno != EAGAIN && errno != EINTR)
+                fatal_system_error("server write");
+            if (ret > 0)
+                out.start += ret;
+            if (out.start == out.len)
+                out.start=out.len=0;
+        }
+        if (pfd[n_read].revents)
+        {
+            ssize_t ret=batch_buf_read(&replies, cc->fd_read);
 
+            if (ret < 0 && errno != EAGAIN && errno != EINTR)
+                fatal_system_error("read");
+            if (ret == 0)
+            {
+                if (outstanding > 0)
+                    fatal_error("the queuer closed the connection");
+                break;
+            }
+            outstanding -= batch_handle_replies(&replies, show_tags, errcode);
+            if (replies.start == replies.len)
+                replies.start=replies.len=0;
+        }
+    }
+    free(in.buf);
+    free(out.buf);
+    free(replies.buf);
+}
@@ -35,6 +35,13 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define CLIENT_CONN_BUF_SIZE 10*1024
 
+/* while another client starts the server, we try to connect again after 
+   waiting for a time that doubles from the minimum up to the step 
+   maximum, until we've waited for the maximum. */
+#define CLIENT_WAIT_MIN_US 1000
+#define CLIENT_WAIT_STEP_MAX_US 100000
+#define CLIENT_WAIT_MAX_US 30000000
+
 typedef struct
 {
     int fd_read; /* input file descriptor */
@@ -52,6 +59,19 @@ void client_connection_destroy(client_connection *dc);
 void client_connection_send_request(client_connection *dc, int argc, 
                                     char *argv[]);
 
+/* run a batch session: read commands from stdin, one per line, send them
+   all over the connection, and print the replies as they come in. With
+   show_tags, each line of a reply starts with the input line number of
+   its command. Sets errcode if any command failed. */
+void client_connection_batch(client_connection *dc, const char *argv0, 
+                             int show_tags, int *errcode);
+
+/* answer 'ls' and 'info' from the daemon's snapshot file, without 
+   connecting to it. Returns 0 if the daemon must be asked instead: for
+   other commands, if there is no current snapshot, or if the job isn't
+   in it. */
+int client_snapshot_print(suq_settings *st, int argc, char *argv[]);
+
 /* get the results as a string from a daemon, with an error code. 
     Runs until incoming connection closes. */
 void client_connection_get_print_results(client_connection *dc, int *errcode);
@@ -40,12 +40,14 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/socket.h>
 
 #include "err.h"
 #include "connection.h"
 #include "settings.h"
 #include "server.h"
+#include "protocol.h"
 #include "request.h"
 
 void conn_list_init(conn_list *cl)
@@ -113,6 +115,18 @@ void conn_list_remove(conn_list *cl, connection *c)
     free(c);
 }
 
+void conn_list_remove_flushed(conn_list *cl, connection *c)
+{
+    if (!connection_pending(c) || c->dead)
+    {
+        conn_list_remove(cl, c);
+        return;
+    }
+    c->keep_alive=0;
+    c->close_after_flush=1;
+    event_mod(&(c->ev), (c->read_fd == c->write_fd) ? EVENT_WRITE : 0);
+}
+
 int conn_list_N(conn_list *cl)
 {
     return cl->N;
@@ -124,7 +138,8 @@ void conn_list_remove_closed(conn_list *cl)
     while(cn != cl->head)
     {
         connection *next=cn->next;
-        if (!cn->write_open || ((!cn->read_open) && (!cn->keep_alive) ) )
+        if (!cn->write_open || cn->dead ||
+            ((!cn->read_open) && (!cn->keep_alive) ) )
         {
             if (debug>1)
                 printf("SERVER: removing connection\n");
@@ -144,12 +159,30 @@ connection *connection_new(int read_fd, int write_fd)
 
     cn->read_buf=NULL;
     cn->read_buf_alloc=0;
+    cn->read_buf_start=0;
     cn->read_buf_cursor=0;
+    cn->read_buf_scan=0;
     cn->read_buf_request=0;
+    cn->read_buf_framed=0;
+    cn->nfds=0;
+    cn->fds_lost=0;
 
     cn->write_open=1;
     cn->read_open=1;
     cn->keep_alive=1;
+    cn->session=0;
+
+    cn->write_buf=NULL;
+    cn->write_buf_alloc=0;
+    cn->write_head=0;
+    cn->write_tail=0;
+    cn->close_after_flush=0;
+    cn->defer_write=0;
+    cn->deferred=0;
+    cn->dead=0;
+
+    event_source_init(&(cn->ev));
+    event_source_init(&(cn->wev));
 
     /* now set the close-on-exec flag because we don't want children to
        inherit these. */
@@ -162,6 +195,9 @@ connection *connection_new(int read_fd, int write_fd)
 
 void connection_close(connection *c)
 {
+    /* the event loop must forget about it before the fd is closed */
+    event_del(&(c->ev));
+    event_del(&(c->wev));
     if ( (c->read_fd != c->write_fd) && (c->read_open) )
     {
         if (debug>1)
@@ -180,63 +216,401 @@ void connection_close(connection *c)
 
 void connection_destroy(connection *c)
 {
+    int i;
+
     connection_close(c);
+    for(i=0;i<c->nfds;i++)
+        close(c->fds[i]);
+    c->nfds=0;
     free(c->read_buf);
+    free(c->write_buf);
+    c->write_buf=NULL;
     c->read_fd=-1;
     c->write_fd=-1;
 }
 
-int connection_read(connection *c, suq_serv *cs)
+int connection_take_fds(connection *c, int *fds, int n)
 {
-    int res;
-    size_t j;
-    int end_found=0;
+    int i;
+    int ntake=(n < c->nfds) ? n : c->nfds;
+    int ret=(c->fds_lost || ntake < n) ? -1 : 0;
 
-    /* first check the buffer, and reallocate if neccesary */
-    if (c->read_buf_cursor >= c->read_buf_alloc)
+    for(i=0;i<ntake;i++)
     {
-        int new_alloc = c->read_buf_alloc+CONN_BUF_SIZE;
-        c->read_buf = realloc_check_server(c->read_buf, new_alloc);
-        c->read_buf_alloc = new_alloc;
+        if (ret == 0)
+            fds[i]=c->fds[i];
+        else
+            close(c->fds[i]);
     }
+    c->nfds -= ntake;
+    memmove(c->fds, c->fds + ntake, c->nfds*sizeof(int));
+    c->fds_lost=0;
+    return ret;
+}
 
-    /* do the read we should do */
-    res=read(c->read_fd, 
-             c->read_buf + c->read_buf_cursor, 
-             c->read_buf_alloc - c->read_buf_cursor);
-    if (res<0)
+/* read from the client into buf, and keep the file descriptors it passed
+   along */
+static ssize_t connection_recv(connection *c, char *buf, size_t len)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    union
     {
-        server_system_error("Read error");
+        char buf[CMSG_SPACE(sizeof(int)*CONN_MAX_FDS)];
+        struct cmsghdr align;
+    } ctl;
+    struct cmsghdr *cmsg;
+    ssize_t res;
+
+    iov.iov_base=buf;
+    iov.iov_len=len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    msg.msg_control=ctl.buf;
+    msg.msg_controllen=sizeof(ctl.buf);
+
+    res=recvmsg(c->read_fd, &msg, MSG_CMSG_CLOEXEC);
+    if (res < 0 && errno == ENOTSOCK)
+        return read(c->read_fd, buf, len);
+    if (res < 0)
         return res;
+
+    for(cmsg=CMSG_FIRSTHDR(&msg); cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+        {
+            int n=(cmsg->cmsg_len - CMSG_LEN(0))/sizeof(int);
+            int i;
+
+            for(i=0;i<n;i++)
+            {
+                int fd;
+
+                memcpy(&fd, CMSG_DATA(cmsg) + i*sizeof(int), sizeof(int));
+                if (c->nfds < CONN_MAX_FDS)
+                    c->fds[c->nfds++]=fd;
+                else
+                {
+                    close(fd);
+                    c->fds_lost=1;
+                }
+            }
+        }
+    }
+    /* the kernel drops descriptors we have no room for, as when we're out
+       of them. The descriptors always come with the first byte of a
+       request, so they are those of the next one. */
+    if (msg.msg_flags & MSG_CTRUNC)
+        c->fds_lost=1;
+    return res;
+}
+
+/* make sure there's room for at least len more bytes after the input */
+static void connection_read_reserve(connection *c, size_t len)
+{
+    size_t used=c->read_buf_cursor - c->read_buf_start;
+
+    if (c->read_buf_cursor + len <= c->read_buf_alloc)
+        return;
+
+    /* first move what's left of the input to the start */
+    if (c->read_buf_start > 0)
+    {
+        memmove(c->read_buf, c->read_buf + c->read_buf_start, used);
+        c->read_buf_start=0;
+        c->read_buf_cursor=used;
+        if (used + len <= c->read_buf_alloc)
+            return;
     }
-    c->read_buf_cursor += res;
-    /* now check for and end-of-message marker: three nuls */
-    for(j=2;j<c->read_buf_cursor;j++)
+    /* then grow geometrically, so large requests take few reallocs */
     {
-        if (c->read_buf[j-2]==0 && c->read_buf[j-1]==0 && c->read_buf[j]==0)
+        size_t new_alloc=c->read_buf_alloc ? c->read_buf_alloc : 
+                                             CONN_BUF_SIZE;
+        while(new_alloc < used + len)
+            new_alloc *= 2;
+        c->read_buf=realloc_check_server(c->read_buf, new_alloc);
+        c->read_buf_alloc=new_alloc;
+    }
+}
+
+/* check whether there's a complete request at the start of the input.
+   Returns 1 if there is, 0 if we need more input and -1 if it's not in
+   a format we understand. */
+static int connection_find_request(connection *c)
+{
+    char *buf=c->read_buf + c->read_buf_start;
+    size_t len=c->read_buf_cursor - c->read_buf_start;
+
+    if (len == 0)
+        return 0;
+
+    if (buf[0] == 0)
+    {
+        /* a frame: its header tells us how long it is */
+        size_t frame_len;
+
+        if (proto_frame_check(buf, len, &frame_len) < 0)
+            return -1;
+        if (frame_len == 0)
+            return 0;
+        if (len >= frame_len)
         {
-            c->read_buf_request=j-1;
-            end_found=1;
-            break;
+            c->read_buf_request=frame_len;
+            c->read_buf_framed=1;
+            return 1;
         }
+        /* make room for all of it at once */
+        connection_read_reserve(c, frame_len - len);
+        return 0;
     }
-    if (end_found && (c->read_buf_request > 0) )
+    else
     {
-        request_process(c, cs);
+        /* the old format ends with three nuls. We continue where the 
+           last look ended, jumping from nul to nul. */
+        size_t j=c->read_buf_scan;
 
-        if (c->keep_alive)
+        while(j < len)
         {
-            /* shift the buffer so that the unprocessed part is at 0 */
-            for(j=c->read_buf_request; j<c->read_buf_cursor; j++)
+            char *nul=memchr(buf + j, 0, len - j);
+
+            if (!nul)
+            {
+                j=len;
+                break;
+            }
+            j=nul - buf;
+            if (j + 2 >= len)
+                break; /* can't tell yet */
+            if (buf[j+1]==0 && buf[j+2]==0)
             {
-                c->read_buf[j - c->read_buf_request] = c->read_buf[j];
+                c->read_buf_request=j+3; /* the nuls are part of it */
+                c->read_buf_framed=0;
+                c->read_buf_scan=0;
+                return 1;
             }
-            c->read_buf_cursor -= c->read_buf_request;
+            j++;
+        }
+        c->read_buf_scan=j;
+        return 0;
+    }
+}
+
+int connection_read(connection *c, suq_serv *cs)
+{
+    ssize_t res;
+
+    /* the fd is edge-triggered, so we read until there's nothing left */
+    for(;;)
+    {
+        int found=connection_find_request(c);
+
+        if (found < 0)
+        {
+            const char *msg="ERROR: unsupported request format\n";
+
+            server_error("unsupported request format");
+            connection_write_reply(c, NULL, 0, msg, strlen(msg));
+            c->keep_alive=0;
+            return 1;
+        }
+        if (found > 0)
+        {
+            request_process(c, cs);
+
+            /* the caller removes connections that are done */
+            if (!c->keep_alive)
+                return 1;
+
+            /* the rest of the input is the next request */
+            c->read_buf_start += c->read_buf_request;
             c->read_buf_request=0;
+            if (c->read_buf_start == c->read_buf_cursor)
+                c->read_buf_start=c->read_buf_cursor=0;
+            /* a client that doesn't keep up with its replies has to wait:
+               we continue once they're sent */
+            if (connection_pending(c) && !c->deferred)
+                return 1;
+            continue;
         }
+
+        /* we need more: make sure there's some room */
+        if (c->read_buf_cursor == c->read_buf_alloc)
+            connection_read_reserve(c, CONN_BUF_SIZE);
+
+        /* do the read we should do */
+        res=connection_recv(c, c->read_buf + c->read_buf_cursor, 
+                            c->read_buf_alloc - c->read_buf_cursor);
+        if (res<0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            if (errno == EINTR)
+                continue;
+            server_system_error("Read error");
+            return 0;
+        }
+        if (res == 0)
+            return 0;
+
+        c->read_buf_cursor += res;
     }
+}
 
-    return res;
+int connection_pending(connection *c)
+{
+    return c->write_tail > c->write_head;
+}
+
+/* wait for writability of the write fd, or not */
+static void connection_want_write(connection *c, int want)
+{
+    if (c->read_fd == c->write_fd)
+    {
+        /* replies come before new requests */
+        if (want)
+            event_mod(&(c->ev), EVENT_WRITE);
+        else if (!c->close_after_flush)
+            event_mod(&(c->ev), EVENT_READ);
+    }
+    else
+    {
+        if (want && !c->wev.el && c->ev.el)
+        {
+            event_add(c->ev.el, &(c->wev), c->write_fd, EVENT_WRITE,
+                      c->ev.func, c);
+        }
+        else if (!want)
+        {
+            event_del(&(c->wev));
+        }
+        event_mod(&(c->ev), (want || c->close_after_flush) ? 0 : EVENT_READ);
+    }
+}
+
+int connection_flush(connection *c)
+{
+    c->deferred=0;
+    while(c->write_tail > c->write_head)
+    {
+        ssize_t res=write(c->write_fd, c->write_buf + c->write_head, 
+                          c->write_tail - c->write_head);
+
+        if (res < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 1;
+            if (errno == EINTR)
+                continue;
+            if (debug>0)
+                printf("SERVER: write to client failed: %s\n", 
+                       strerror(errno));
+            c->dead=1;
+            return -1;
+        }
+        c->write_head += res;
+    }
+    /* it's all out */
+    c->write_head=c->write_tail=0;
+    connection_want_write(c, 0);
+    return 0;
+}
+
+int connection_write(connection *c, const char *buf, size_t len)
+{
+    size_t queued;
+
+    if (c->dead)
+        return -1;
+
+    /* if nothing is queued, we try to send it right away */
+    if (!connection_pending(c) && c->defer_write)
+    {
+        c->deferred=1;
+    }
+    else if (!connection_pending(c))
+    {
+        while(len > 0)
+        {
+            ssize_t res=write(c->write_fd, buf, len);
+
+            if (res < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                if (errno == EINTR)
+                    continue;
+                c->dead=1;
+                return -1;
+            }
+            buf += res;
+            len -= res;
+        }
+        if (len == 0)
+            return 0;
+    }
+
+    queued=c->write_tail - c->write_head;
+    if (queued + len > CONN_WRITE_MAX)
+    {
+        if (debug>0)
+            printf("SERVER: client doesn't read its replies\n");
+        c->dead=1;
+        return -1;
+    }
+    /* make room: first by moving the unsent part to the start */
+    if (c->write_tail + len > c->write_buf_alloc && c->write_head > 0)
+    {
+        memmove(c->write_buf, c->write_buf + c->write_head, queued);
+        c->write_head=0;
+        c->write_tail=queued;
+    }
+    if (c->write_tail + len > c->write_buf_alloc)
+    {
+        size_t new_alloc=c->write_buf_alloc ? c->write_buf_alloc : 
+                                              CONN_BUF_SIZE;
+        while(new_alloc < c->write_tail + len)
+            new_alloc *= 2;
+        c->write_buf=realloc_check_server(c->write_buf, new_alloc);
+        c->write_buf_alloc=new_alloc;
+    }
+    memcpy(c->write_buf + c->write_tail, buf, len);
+    c->write_tail += len;
+    connection_want_write(c, 1);
+    return 0;
 }
 
+int connection_write_reply(connection *c, const char *tag, int flags,
+                           const char *text, size_t len)
+{
+    char hdr[PROTO_HEADER_SIZE + PROTO_FIELD_HEADER_SIZE];
+    size_t taglen=tag ? strlen(tag)+1 : 0;
+    size_t length;
+
+    if (!c->session)
+        return connection_write(c, text, len+1);
 
+    if (strncmp(text, "ERROR", strlen("ERROR"))==0)
+        flags |= PROTO_FLAG_ERROR;
+    length=PROTO_FIELD_HEADER_SIZE + len + 1;
+    if (tag)
+        length += PROTO_FIELD_HEADER_SIZE + taglen;
+
+    proto_put_header(hdr, flags, length);
+    if (tag)
+    {
+        proto_put_field_header(hdr + PROTO_HEADER_SIZE, PROTO_FIELD_TAG,
+                               taglen);
+        if (connection_write(c, hdr, sizeof(hdr)) < 0 ||
+            connection_write(c, tag, taglen) < 0)
+            return -1;
+    }
+    else if (connection_write(c, hdr, PROTO_HEADER_SIZE) < 0)
+    {
+        return -1;
+    }
+    proto_put_field_header(hdr, PROTO_FIELD_TEXT, len+1);
+    if (connection_write(c, hdr, PROTO_FIELD_HEADER_SIZE) < 0)
+        return -1;
+    return connection_write(c, text, len+1);
+}
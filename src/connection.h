@@ -1,4 +1,4 @@
-/* This source code is part of 
+/* This source code is part of
 
 suq, the Single-User Queuer
 
@@ -32,8 +32,17 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __CONNECTION_H__
 #define __CONNECTION_H__
 
+#include "event.h"
+
 #define CONN_BUF_SIZE 10*1024
 
+/* the most reply bytes we keep for a client that doesn't read them; a
+   client that falls further behind is disconnected */
+#define CONN_WRITE_MAX (16*1024*1024)
+
+/* the most passed file descriptors we hold for requests not yet handled */
+#define CONN_MAX_FDS 8
+
 typedef struct connection
 {
     int read_fd, write_fd; /* the file descriptors */
@@ -42,14 +51,40 @@ typedef struct connection
 
     char *read_buf; /* read buffer. */
     size_t read_buf_alloc; /* allocated size of read_buf */
+    size_t read_buf_start; /* start of the unprocessed input in read_buf */
     size_t read_buf_cursor; /* end of last read in read_buf */
-    size_t read_buf_request; /* end of the request in read_buf */
-    
+    size_t read_buf_scan; /* how far from read_buf_start we've looked for 
+                             the end of an old-format request */
+    size_t read_buf_request; /* length of the request at read_buf_start */
+    int read_buf_framed; /* whether that request is a frame (see protocol.h)
+                            rather than in the old nul-delimited format */
+
+    int fds[CONN_MAX_FDS]; /* the file descriptors the client passed, in 
+                              the order they came in */
+    int nfds; /* the number of them */
+    int fds_lost; /* whether some of those of the next request were lost */
+
     int read_open; /* whether the connection is still open for reads */
     int write_open; /* whether the connection is still open for writes */
 
     int keep_alive; /* whether the connection should be kept alive after
                        the read EOFs */
+    int session; /* whether the client sends more than one request, and 
+                    gets framed replies (see PROTO_FLAG_SESSION) */
+
+    char *write_buf; /* the queued output */
+    size_t write_buf_alloc; /* allocated size of write_buf */
+    size_t write_head; /* the start of the unsent output in write_buf */
+    size_t write_tail; /* the end of the unsent output in write_buf */
+    int close_after_flush; /* whether to remove it once the output is sent */
+    int defer_write; /* whether writes are only queued, to be sent when the 
+                        event loop finds the fd writable */
+    int deferred; /* whether the queued output is only waiting for that, 
+                     rather than for the client to read it */
+    int dead; /* whether writing failed, so that it should be removed */
+
+    event_source ev; /* its registration with the event loop */
+    event_source wev; /* the same for write_fd, if it's not read_fd */
 } connection;
 
 /* the circular list header */
@@ -78,6 +113,10 @@ void conn_list_add(conn_list *cl, connection *c);
     connection. */
 void conn_list_remove(conn_list *cl, connection *c);
 
+/* remove a connection from the list once its queued output has been sent.
+   Until then, nothing more is read from it. */
+void conn_list_remove_flushed(conn_list *cl, connection *c);
+
 /* remove all closed connections from the list */
 void conn_list_remove_closed(conn_list *cl);
 
@@ -101,9 +140,36 @@ void connection_close(connection *cn);
 /* close & deallocate the contents of the connection */
 void connection_destroy(connection *cn);
 
+/* take the n file descriptors passed with the current request, and put 
+   them in fds. Returns 0 on success, or -1 if they didn't all arrive;
+   those that did are closed then. */
+int connection_take_fds(connection *c, int *fds, int n);
+
 struct suq_serv;
-/* read data, and process it */
+/* read all available data, and process it. Returns 0 if the connection was
+   closed by the other side (or failed), and 1 otherwise. */
 int connection_read(connection *conn, struct suq_serv *cs);
 
+/* write len bytes of buf to the connection. What can't be written right
+   away is queued, and sent by connection_flush when the fd is writable.
+   While output is queued, the connection isn't read from. Returns 0 on
+   success, and -1 if the connection failed or its client fell too far
+   behind; it is then removed by conn_list_remove_closed. */
+int connection_write(connection *conn, const char *buf, size_t len);
+
+/* write a reply text of len bytes (not counting the nul). Outside of a 
+   session, that's just the nul-terminated text; in a session, it's a 
+   frame with the tag (if not NULL), and flags that may include 
+   PROTO_FLAG_PARTIAL. Returns as connection_write(). */
+int connection_write_reply(connection *conn, const char *tag, int flags,
+                           const char *text, size_t len);
+
+/* send queued output. Returns 0 if everything was sent, 1 if there is more
+   to send, and -1 if the connection failed. */
+int connection_flush(connection *conn);
+
+/* check whether there is queued output */
+int connection_pending(connection *conn);
+
 #endif
 
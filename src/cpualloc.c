@@ -0,0 +1,142 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/param.h>
+
+#include "err.h"
+#include "cpualloc.h"
+
+
+void cpu_alloc_init(cpu_alloc *ca)
+{
+    cpu_set_t set;
+    int i;
+
+    ca->ncpu=0;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) < 0)
+    {
+        server_system_error("sched_getaffinity");
+        CPU_SET(0, &set);
+    }
+    ca->cpus=malloc_check_server(sizeof(int)*CPU_COUNT(&set));
+    ca->owner=malloc_check_server(sizeof(int)*CPU_COUNT(&set));
+    for(i=0;i<CPU_SETSIZE;i++)
+    {
+        if (CPU_ISSET(i, &set))
+        {
+            ca->cpus[ca->ncpu]=i;
+            ca->owner[ca->ncpu]=CPU_OWNER_FREE;
+            ca->ncpu++;
+        }
+    }
+}
+
+void cpu_alloc_destroy(cpu_alloc *ca)
+{
+    free(ca->cpus);
+    free(ca->owner);
+}
+
+int cpu_alloc_get(cpu_alloc *ca, int id, int n, cpu_set_t *set)
+{
+    int i;
+    int nalloc=0;
+
+    CPU_ZERO(set);
+    /* the free ones first */
+    for(i=0; i<ca->ncpu && nalloc<n; i++)
+    {
+        if (ca->owner[i] == CPU_OWNER_FREE)
+        {
+            ca->owner[i]=id;
+            CPU_SET(ca->cpus[i], set);
+            nalloc++;
+        }
+    }
+    /* if there aren't enough, we have to share. The ones at the end are 
+       least likely to be taken by the next job. */
+    for(i=ca->ncpu-1; i>=0 && nalloc<n; i--)
+    {
+        if (!CPU_ISSET(ca->cpus[i], set))
+        {
+            CPU_SET(ca->cpus[i], set);
+            nalloc++;
+        }
+    }
+    return nalloc;
+}
+
+void cpu_alloc_release(cpu_alloc *ca, int id)
+{
+    int i;
+
+    for(i=0;i<ca->ncpu;i++)
+    {
+        if (ca->owner[i] == id)
+            ca->owner[i]=CPU_OWNER_FREE;
+    }
+}
+
+int cpu_pin_process(pid_t pid, cpu_set_t *set)
+{
+    char dirname[MAXPATHLEN];
+    DIR *dir;
+    struct dirent *de;
+    int ret=0;
+
+    /* every thread has its own mask */
+    snprintf(dirname, MAXPATHLEN, "/proc/%d/task", pid);
+    dir=opendir(dirname);
+    if (!dir)
+        return sched_setaffinity(pid, sizeof(cpu_set_t), set);
+    while( (de=readdir(dir)) )
+    {
+        char *end;
+        pid_t tid=strtol(de->d_name, &end, 10);
+
+        if (end == de->d_name || *end != 0)
+            continue;
+        if (sched_setaffinity(tid, sizeof(cpu_set_t), set) < 0)
+            ret=-1;
+    }
+    closedir(dir);
+    return ret;
+}
@@ -0,0 +1,66 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __CPUALLOC_H__
+#define __CPUALLOC_H__
+
+#include <sched.h>
+#include <sys/types.h>
+
+/* the owner of a cpu that no job holds. Job ids start over at 0, so 
+   that can't be it. */
+#define CPU_OWNER_FREE (-1)
+
+/* the allocation of the cpus we may use to jobs */
+typedef struct cpu_alloc
+{
+    int ncpu; /* the number of cpus we may use */
+    int *cpus; /* their numbers, from our affinity mask */
+    int *owner; /* the id of the job holding each cpu, or CPU_OWNER_FREE */
+} cpu_alloc;
+
+
+/* initialize the cpu allocation from our own affinity mask */
+void cpu_alloc_init(cpu_alloc *ca);
+
+/* deallocate the cpu allocation contents */
+void cpu_alloc_destroy(cpu_alloc *ca);
+
+/* allocate n cpus to job id, preferring cpus that nobody holds. The
+   cpus are put in set. Returns the number of cpus allocated. */
+int cpu_alloc_get(cpu_alloc *ca, int id, int n, cpu_set_t *set);
+
+/* release the cpus held by job id */
+void cpu_alloc_release(cpu_alloc *ca, int id);
+
+/* set the affinity of all threads of process pid. Returns 0 on success */
+int cpu_pin_process(pid_t pid, cpu_set_t *set);
+
+#endif /* __CPUALLOC_H__ */
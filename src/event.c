@@ -0,0 +1,547 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include <stdint.h>
+
+#include "err.h"
+#include "event.h"
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+/* the number of submission entries in the ring */
+#define EVENT_URING_ENTRIES 256
+/* the user data of completions we ignore, such as poll removals */
+#define EVENT_URING_IGNORE ((uint64_t)-1)
+#endif
+
+
+void event_loop_init(event_loop *el)
+{
+    el->N=0;
+    el->nready=0;
+    el->ready_alloc=EVENT_BATCH;
+    el->ready=malloc_check_server(sizeof(event_source*)*el->ready_alloc);
+    el->ready_events=malloc_check_server(sizeof(int)*el->ready_alloc);
+    el->sources=NULL;
+    el->nalloc=0;
+    el->nslots=0;
+    el->gen=0;
+    el->ring=NULL;
+    el->epfd=-1;
+#ifdef HAVE_IO_URING
+    el->ring=malloc_check_server(sizeof(uring));
+    if (uring_init(el->ring, EVENT_URING_ENTRIES) == 0)
+        return;
+    server_system_error("io_uring_setup; using epoll");
+    free(el->ring);
+    el->ring=NULL;
+#endif
+#ifdef __linux__
+    el->epfd=epoll_create1(EPOLL_CLOEXEC);
+    if (el->epfd < 0)
+        server_system_error("epoll_create1; using poll()");
+#endif
+}
+
+void event_loop_destroy(event_loop *el)
+{
+#ifdef HAVE_IO_URING
+    if (el->ring)
+    {
+        uring_destroy(el->ring);
+        free(el->ring);
+        el->ring=NULL;
+    }
+#endif
+    if (el->epfd >= 0)
+        close(el->epfd);
+    free(el->sources);
+    free(el->ready);
+    free(el->ready_events);
+    el->sources=NULL;
+    el->ready=NULL;
+    el->ready_events=NULL;
+}
+
+void event_source_init(event_source *es)
+{
+    es->fd=-1;
+    es->el=NULL;
+    es->index=-1;
+    es->armed=0;
+    es->gen=0;
+}
+
+int event_set_nonblock(int fd)
+{
+    int flags=fcntl(fd, F_GETFL);
+
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags|O_NONBLOCK);
+}
+
+#ifdef __linux__
+/* translate our events to epoll's */
+static unsigned int event_to_epoll(int events)
+{
+    unsigned int ret=EPOLLET;
+
+    if (events & EVENT_READ)
+        ret |= EPOLLIN|EPOLLRDHUP;
+    if (events & EVENT_WRITE)
+        ret |= EPOLLOUT;
+    return ret;
+}
+#endif
+
+#ifdef HAVE_IO_URING
+/* The io_uring backend queues a one-shot poll for each source. Its 
+   completion is dispatched like an epoll event, after which the poll is 
+   queued again. Because sources are drained until EAGAIN, re-arming them
+   gives the same result as epoll's edge triggering. The queued polls, 
+   their removals and the wait for completions (with the timeout) all go
+   to the kernel in a single io_uring_enter() per loop iteration. */
+
+/* the user data of a source's poll: its slot and generation */
+static uint64_t event_uring_data(event_source *es)
+{
+    return ((uint64_t)es->gen << 32) | (uint32_t)es->index;
+}
+
+/* queue a poll for the source's events */
+static int event_uring_arm(event_loop *el, event_source *es)
+{
+    struct io_uring_sqe *sqe;
+    unsigned mask=0;
+
+    /* without events, there'd be nothing but hangups to wait for, and 
+       those would be reported again at every re-arm */
+    if (es->events == 0)
+        return 0;
+    if (es->events & EVENT_READ)
+        mask |= POLLIN|POLLRDHUP;
+    if (es->events & EVENT_WRITE)
+        mask |= POLLOUT;
+
+    sqe=uring_get_sqe(el->ring);
+    if (!sqe)
+    {
+        server_system_error("io_uring poll");
+        return -1;
+    }
+    es->gen=++el->gen;
+    sqe->opcode=IORING_OP_POLL_ADD;
+    sqe->fd=es->fd;
+    sqe->poll32_events=mask;
+    sqe->user_data=event_uring_data(es);
+    es->armed=1;
+    return 0;
+}
+
+/* queue the removal of the source's outstanding poll */
+static void event_uring_disarm(event_loop *el, event_source *es)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!es->armed)
+        return;
+    es->armed=0;
+    sqe=uring_get_sqe(el->ring);
+    if (!sqe)
+    {
+        /* its completion will be ignored anyway */
+        server_system_error("io_uring poll remove");
+        return;
+    }
+    sqe->opcode=IORING_OP_POLL_REMOVE;
+    sqe->fd=-1;
+    sqe->addr=event_uring_data(es);
+    sqe->user_data=EVENT_URING_IGNORE;
+}
+
+/* translate a poll completion to our events */
+static int event_uring_events(int res)
+{
+    int events=0;
+
+    if (res < 0)
+        return EVENT_ERROR|EVENT_READ;
+    if (res & (POLLIN|POLLRDHUP))
+        events |= EVENT_READ;
+    if (res & POLLOUT)
+        events |= EVENT_WRITE;
+    if (res & (POLLERR|POLLNVAL))
+        events |= EVENT_ERROR|EVENT_READ;
+    if (res & POLLHUP)
+        events |= EVENT_HANGUP|EVENT_READ;
+    return events;
+}
+
+/* collect the completions of current polls into the ready list */
+static void event_uring_collect(event_loop *el)
+{
+    struct io_uring_cqe *cqe;
+
+    el->nready=0;
+    /* what doesn't fit stays in the queue until the next wait */
+    while(el->nready < el->ready_alloc && (cqe=uring_peek_cqe(el->ring)))
+    {
+        uint64_t ud=cqe->user_data;
+
+        if (ud != EVENT_URING_IGNORE)
+        {
+            uint32_t slot=(uint32_t)ud;
+            event_source *es=NULL;
+
+            if (slot < (uint32_t)el->nslots)
+                es=el->sources[slot];
+            /* an earlier poll of this source, or of an earlier source in 
+               the same slot, may still complete after its removal */
+            if (es && es->armed && es->gen == (unsigned)(ud >> 32))
+            {
+                es->armed=0;
+                el->ready[el->nready]=es;
+                el->ready_events[el->nready]=event_uring_events(cqe->res);
+                el->nready++;
+            }
+        }
+        uring_cqe_seen(el->ring);
+    }
+}
+#endif
+
+int event_add(event_loop *el, event_source *es, int fd, int events, 
+              event_func func, void *data)
+{
+    es->fd=fd;
+    es->events=events;
+    es->func=func;
+    es->data=data;
+    es->el=el;
+    es->index=-1;
+    es->armed=0;
+
+    if (event_set_nonblock(fd) < 0)
+        server_system_error("fcntl(O_NONBLOCK)");
+
+#ifdef HAVE_IO_URING
+    if (el->ring)
+    {
+        int slot;
+
+        /* take the first free slot */
+        for(slot=0;slot<el->nslots;slot++)
+        {
+            if (!el->sources[slot])
+                break;
+        }
+        if (slot == el->nslots)
+        {
+            if (el->nslots >= el->nalloc)
+            {
+                el->nalloc = (el->nalloc > 0) ? 2*el->nalloc : 64;
+                el->sources=realloc_check_server(el->sources, 
+                                        el->nalloc*sizeof(event_source*));
+            }
+            el->nslots++;
+        }
+        es->index=slot;
+        el->sources[slot]=es;
+        el->N++;
+        if (event_uring_arm(el, es) < 0)
+        {
+            el->sources[slot]=NULL;
+            el->N--;
+            es->index=-1;
+            es->el=NULL;
+            return -1;
+        }
+        return 0;
+    }
+#endif
+
+#ifdef __linux__
+    if (el->epfd >= 0)
+    {
+        struct epoll_event ev;
+
+        ev.events=event_to_epoll(events);
+        ev.data.ptr=es;
+        if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        {
+            server_system_error("epoll_ctl(EPOLL_CTL_ADD)");
+            es->el=NULL;
+            return -1;
+        }
+        el->N++;
+        return 0;
+    }
+#endif
+    if (el->N >= el->nalloc)
+    {
+        el->nalloc = (el->nalloc > 0) ? 2*el->nalloc : 64;
+        el->sources=realloc_check_server(el->sources, 
+                                         el->nalloc*sizeof(event_source*));
+    }
+    es->index=el->N;
+    el->sources[el->N++]=es;
+    return 0;
+}
+
+int event_mod(event_source *es, int events)
+{
+    event_loop *el=es->el;
+
+    if (!el)
+        return -1;
+#ifdef HAVE_IO_URING
+    if (el->ring)
+    {
+        if (es->armed && es->events == events)
+            return 0;
+        es->events=events;
+        event_uring_disarm(el, es);
+        return event_uring_arm(el, es);
+    }
+#endif
+    es->events=events;
+#ifdef __linux__
+    if (el->epfd >= 0)
+    {
+        struct epoll_event ev;
+
+        ev.events=event_to_epoll(events);
+        ev.data.ptr=es;
+        if (epoll_ctl(el->epfd, EPOLL_CTL_MOD, es->fd, &ev) < 0)
+        {
+            server_system_error("epoll_ctl(EPOLL_CTL_MOD)");
+            return -1;
+        }
+    }
+#endif
+    return 0;
+}
+
+void event_del(event_source *es)
+{
+    event_loop *el=es->el;
+    int i;
+
+    if (!el)
+        return;
+
+    /* it may still have events waiting to be dispatched */
+    for(i=0;i<el->nready;i++)
+    {
+        if (el->ready[i] == es)
+            el->ready[i]=NULL;
+    }
+
+#ifdef HAVE_IO_URING
+    if (el->ring)
+    {
+        event_uring_disarm(el, es);
+        el->sources[es->index]=NULL;
+        /* give back the slots at the end */
+        while(el->nslots > 0 && !el->sources[el->nslots-1])
+            el->nslots--;
+        el->N--;
+        es->index=-1;
+        es->el=NULL;
+        return;
+    }
+#endif
+#ifdef __linux__
+    if (el->epfd >= 0)
+    {
+        if (epoll_ctl(el->epfd, EPOLL_CTL_DEL, es->fd, NULL) < 0)
+            server_system_error("epoll_ctl(EPOLL_CTL_DEL)");
+        el->N--;
+        es->el=NULL;
+        return;
+    }
+#endif
+    /* move the last one into its place */
+    el->N--;
+    if (es->index != el->N)
+    {
+        el->sources[es->index]=el->sources[el->N];
+        el->sources[es->index]->index=es->index;
+    }
+    es->index=-1;
+    es->el=NULL;
+}
+
+/* dispatch the ready events */
+static void event_dispatch(event_loop *el)
+{
+    int i;
+
+    for(i=0;i<el->nready;i++)
+    {
+        event_source *es=el->ready[i];
+
+        /* it may have been removed by an earlier one */
+        if (es)
+        {
+            es->func(es, el->ready_events[i], es->data);
+#ifdef HAVE_IO_URING
+            /* its poll was one-shot. If it was removed, its entry is 
+               NULL now. */
+            if (el->ring && el->ready[i] && !es->armed)
+                event_uring_arm(el, es);
+#endif
+        }
+    }
+    el->nready=0;
+}
+
+int event_loop_wait(event_loop *el, long timeout)
+{
+    int n=0;
+    int i;
+
+#ifdef HAVE_IO_URING
+    if (el->ring)
+    {
+        if (uring_submit_and_wait(el->ring, timeout) < 0)
+        {
+            if (errno == ETIME)
+                return 0;
+            return -1;
+        }
+        event_uring_collect(el);
+        n=el->nready;
+        event_dispatch(el);
+        return n;
+    }
+#endif
+#ifdef __linux__
+    if (el->epfd >= 0)
+    {
+        struct epoll_event evs[EVENT_BATCH];
+
+        n=epoll_wait(el->epfd, evs, EVENT_BATCH, 
+                     (timeout >= 0) ? (int)timeout : -1);
+        if (n < 0)
+            return -1;
+        for(i=0;i<n;i++)
+        {
+            int events=0;
+
+            if (evs[i].events & (EPOLLIN|EPOLLRDHUP))
+                events |= EVENT_READ;
+            if (evs[i].events & EPOLLOUT)
+                events |= EVENT_WRITE;
+            if (evs[i].events & EPOLLERR)
+                events |= EVENT_ERROR|EVENT_READ;
+            if (evs[i].events & EPOLLHUP)
+                events |= EVENT_HANGUP|EVENT_READ;
+            el->ready[i]=(event_source*)evs[i].data.ptr;
+            el->ready_events[i]=events;
+        }
+        el->nready=n;
+        event_dispatch(el);
+        return n;
+    }
+#endif
+    {
+        /* poll() is level-triggered, which works just as well for sources
+           that are always drained. */
+        struct pollfd *pfds;
+
+        pfds=malloc_check_server(sizeof(struct pollfd)*(el->N+1));
+        for(i=0;i<el->N;i++)
+        {
+            pfds[i].fd=el->sources[i]->fd;
+            pfds[i].events=0;
+            if (el->sources[i]->events & EVENT_READ)
+                pfds[i].events |= POLLIN;
+            if (el->sources[i]->events & EVENT_WRITE)
+                pfds[i].events |= POLLOUT;
+            pfds[i].revents=0;
+        }
+        n=poll(pfds, el->N, (timeout >= 0) ? (int)timeout : -1);
+        if (n < 0)
+        {
+            free(pfds);
+            return -1;
+        }
+
+        /* collect them all first: the functions may remove sources */
+        if (el->ready_alloc < el->N)
+        {
+            el->ready_alloc=el->N;
+            el->ready=realloc_check_server(el->ready, 
+                                    sizeof(event_source*)*el->ready_alloc);
+            el->ready_events=realloc_check_server(el->ready_events, 
+                                    sizeof(int)*el->ready_alloc);
+        }
+        el->nready=0;
+        for(i=0;i<el->N;i++)
+        {
+            if (pfds[i].revents)
+            {
+                int events=0;
+
+                if (pfds[i].revents & POLLIN)
+                    events |= EVENT_READ;
+                if (pfds[i].revents & POLLOUT)
+                    events |= EVENT_WRITE;
+                if (pfds[i].revents & POLLERR)
+                    events |= EVENT_ERROR|EVENT_READ;
+                if (pfds[i].revents & POLLHUP)
+                    events |= EVENT_HANGUP|EVENT_READ;
+                el->ready[el->nready]=el->sources[i];
+                el->ready_events[el->nready]=events;
+                el->nready++;
+            }
+        }
+        free(pfds);
+        event_dispatch(el);
+        return n;
+    }
+}
@@ -0,0 +1,122 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+/* the events a source can wait for */
+#define EVENT_READ 1
+#define EVENT_WRITE 2
+/* the events that are reported without asking */
+#define EVENT_ERROR 4
+#define EVENT_HANGUP 8
+
+/* the maximum number of events handled per wait */
+#define EVENT_BATCH 64
+
+struct event_source;
+struct event_loop;
+struct uring;
+
+/* the function called when a source has events. Sources are edge-
+   triggered: the function must read (or write) until EAGAIN. */
+typedef void (*event_func)(struct event_source *es, int events, void *data);
+
+/* a file descriptor registered with the event loop */
+typedef struct event_source
+{
+    int fd; /* the file descriptor */
+    int events; /* the events we wait for */
+    event_func func; /* the function to call */
+    void *data; /* its argument */
+
+    struct event_loop *el; /* the loop it's in, or NULL */
+    int index; /* its index in the poll() array, or its io_uring slot */
+
+    /* for io_uring: whether a poll is outstanding, and its generation,
+       which tells its completion apart from those of earlier polls */
+    int armed;
+    unsigned gen;
+} event_source;
+
+/* the event loop: io_uring if it was built with HAVE_IO_URING and the 
+   kernel supports it, otherwise epoll on Linux, and poll() elsewhere. */
+typedef struct event_loop
+{
+    struct uring *ring; /* the io_uring, or NULL */
+    int epfd; /* the epoll fd, or -1 when using io_uring or poll() */
+    int N; /* the number of registered sources */
+
+    /* the sources with events from the last wait, which are being 
+       dispatched. Removed sources are set to NULL. */
+    event_source **ready;
+    int *ready_events;
+    int nready;
+    int ready_alloc;
+
+    /* for poll(): the registered sources. For io_uring: the sources by
+       slot, with NULL for free slots. */
+    event_source **sources;
+    int nalloc;
+    int nslots; /* for io_uring: the number of slots in use or freed */
+    unsigned gen; /* for io_uring: the generation of the last poll */
+} event_loop;
+
+
+/* initialize an event loop */
+void event_loop_init(event_loop *el);
+
+/* destroy an event loop */
+void event_loop_destroy(event_loop *el);
+
+/* initialize a source that's not in a loop */
+void event_source_init(event_source *es);
+
+/* add file descriptor fd to the loop, waiting for events, and calling
+   func(es, events, data) when they occur. The fd is made non-blocking. 
+   Returns 0 on success. */
+int event_add(event_loop *el, event_source *es, int fd, int events, 
+              event_func func, void *data);
+
+/* change the events a source waits for. Returns 0 on success. */
+int event_mod(event_source *es, int events);
+
+/* remove a source from its loop, if it's in one. This must be done 
+   before its fd is closed. */
+void event_del(event_source *es);
+
+/* wait at most timeout ms (or forever if timeout<0) for events, and 
+   dispatch them. Returns the number of events, or -1 on error. */
+int event_loop_wait(event_loop *el, long timeout);
+
+/* make a file descriptor non-blocking. Returns 0 on success. */
+int event_set_nonblock(int fd);
+
+#endif /* __EVENT_H__ */
@@ -41,19 +41,28 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <paths.h>
 #include <sys/param.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sched.h>
 
 #include "err.h"
 #include "wait.h"
 #include "job.h"
 #include "settings.h"
 #include "server.h"
+#include "sig_handler.h"
 #include "signal.h"
 
 #define ERRSTRING_LEN 1024
 
+/* the number of finished jobs that are remembered for 'suq info' */
+#define JOBLIST_HISTORY 64
+
 /* must match job_state enum */
 const char *job_state_strings[] = { "Error", "Error", "Wait", "Started", 
                                     "Running", "Done" };
@@ -61,6 +70,22 @@ const char *job_state_strings[] = { "Error", "Error", "Wait", "Started",
 char *job_resource_error_string = 
 "Requested ntask bigger than the total number available";
 
+char *job_mem_error_string = 
+"Requested memory bigger than the total available";
+
+
+/* open a pidfd for a child process. Returns -1 if the kernel (or libc)
+   doesn't support it, in which case we rely on SIGCHLD. */
+static int job_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno=ENOSYS;
+    return -1;
+#endif
+}
+
 
 void joblist_init(joblist *jl)
 {
@@ -71,6 +96,11 @@ void joblist_init(joblist *jl)
     jl->N=0;
     jl->run_id=0;
 
+    jl->done_head=&(jl->done_head_elem);
+    jl->done_head->next=jl->done_head;
+    jl->done_head->prev=jl->done_head;
+    jl->Ndone=0;
+
     jl->wait_head=&(jl->wait_head_elem);
     jl->wait_head->next = jl->wait_head; /* head elem points back */
     jl->wait_head->prev = jl->wait_head; /* head elem points back */
@@ -86,6 +116,15 @@ void joblist_destroy(joblist *jl)
         joblist_remove(jl, j);
         j=next;
     }
+
+    j=joblist_done_first(jl);
+    while(j)
+    {
+        job *next=joblist_done_next(jl, j);
+        job_destroy(j);
+        free(j);
+        j=next;
+    }
 }
 
 job *joblist_first(joblist *jl)
@@ -106,6 +145,23 @@ job *joblist_next(joblist *jl, job *j)
 
 
 
+job *joblist_done_first(joblist *jl)
+{
+    job *ret=jl->done_head->next;
+    if (ret == jl->done_head)
+        ret=NULL;
+    return ret;
+}
+
+job *joblist_done_next(joblist *jl, job *j)
+{
+    job *ret=j->next;
+    if (ret == jl->done_head)
+        ret=NULL;
+    return ret;
+}
+
+
 void joblist_add(joblist *jl, job *j)
 {
     /* seek out our place in the queue based on our priority */
@@ -141,12 +197,39 @@ void joblist_remove(joblist *jl, job *j)
 
 
     if (j->state == running)
-        job_cancel(j);
+        job_cancel(j, SIGTERM);
 
     job_destroy(j);
     free(j);
 }
 
+void joblist_retire(joblist *jl, job *j)
+{
+    /* remove it from the list */
+    j->next->prev=j->prev;
+    j->prev->next=j->next;
+    jl->N--;
+
+    /* insert it at the head of the finished list */
+    j->next=jl->done_head->next;
+    j->prev=jl->done_head;
+    j->next->prev=j;
+    j->prev->next=j;
+    jl->Ndone++;
+
+    /* and forget the oldest one if there are too many */
+    if (jl->Ndone > JOBLIST_HISTORY)
+    {
+        job *old=jl->done_head->prev;
+
+        old->next->prev=old->prev;
+        old->prev->next=old->next;
+        jl->Ndone--;
+        job_destroy(old);
+        free(old);
+    }
+}
+
 void joblist_re_place(joblist *jl, job *j)
 {
     /* remove it from the list */
@@ -268,10 +351,241 @@ int joblist_N(joblist *jl)
 }
 
 
+/* attribute a process to a running job, and add it to the job's sample */
+static void joblist_sample_proc(proc_info *pi, void *data)
+{
+    joblist *jl=(joblist*)data;
+    job *j=joblist_first(jl);
+
+    while(j)
+    {
+        if ( (j->state == running) && 
+             (pi->pgrp == j->pid || job_has_process(j, pi->pid)) )
+        {
+            unsigned long long rb=0, wb=0;
+
+            sample_proc_io(pi->pid, &rb, &wb);
+            job_sample_add(&(j->smp), pi, rb, wb);
+            return;
+        }
+        j=joblist_next(jl, j);
+    }
+}
+
+void joblist_sample(joblist *jl)
+{
+    job *j;
+
+    j=joblist_first(jl);
+    while(j)
+    {
+        if (j->state == running)
+            job_sample_begin(&(j->smp));
+        j=joblist_next(jl, j);
+    }
+
+    /* one pass over /proc for all jobs */
+    sample_procs(joblist_sample_proc, jl);
+
+    j=joblist_first(jl);
+    while(j)
+    {
+        if (j->state == running)
+            job_sample_end(&(j->smp));
+        j=joblist_next(jl, j);
+    }
+}
+
+/* pin all processes of a job to its cpus */
+static void joblist_pin_proc(proc_info *pi, void *data)
+{
+    job *j=(job*)data;
+
+    if (pi->pgrp == j->pid || job_has_process(j, pi->pid))
+        cpu_pin_process(pi->pid, &(j->cpus));
+}
+
+void joblist_check_oversub(joblist *jl, suq_serv *srv)
+{
+    job *j=joblist_first(jl);
+
+    while(j)
+    {
+        job_sample *js=&(j->smp);
+
+        if (j->state != running || j->ntask <= 0 || js->nsamples == 0)
+        {
+            j=joblist_next(jl, j);
+            continue;
+        }
+
+        /* it has to be sustained: threads come and go */
+        if (js->nthread > j->ntask)
+            j->nthread_over++;
+        else
+            j->nthread_over=0;
+
+        if (j->nthread_over >= 2 && !j->oversub)
+        {
+            j->oversub=1;
+            printf("SERVER: job %d (%s) uses %d threads, but has ntask %d\n",
+                   j->id, j->name, js->nthread, j->ntask);
+        }
+
+        if (j->oversub && srv->st->oversub == OVERSUB_ACCOUNT)
+        {
+            /* account for what it really uses, but never for more than
+               the whole machine */
+            int acct=js->nthread;
+
+            if (acct > srv->st->ntask)
+                acct=srv->st->ntask;
+            if (acct > j->ntask_acct)
+            {
+                printf("SERVER: job %d (%s) now accounted as %d tasks\n",
+                       j->id, j->name, acct);
+                j->ntask_acct=acct;
+            }
+        }
+        else if (j->oversub && srv->st->oversub == OVERSUB_AFFINITY)
+        {
+            /* it normally got its cpus when it started */
+            if (j->ncpus == 0)
+            {
+                j->ncpus=cpu_alloc_get(&(srv->ca), j->id, j->ntask, 
+                                       &(j->cpus));
+            }
+            if (j->nthread_over == 2)
+            {
+                printf("SERVER: job %d (%s) restricted to %d cpus\n",
+                       j->id, j->name, j->ncpus);
+            }
+            /* new processes inherit the mask, but we re-apply it in case
+               something changed it */
+            sample_procs(joblist_pin_proc, j);
+        }
+        j=joblist_next(jl, j);
+    }
+}
+
+/* do the bookkeeping for a job that job_run() was called on. If it 
+   couldn't start, it either stays waiting (the fork may work next time)
+   or is left in place with its error. */
+static void joblist_started(joblist *jl, job *j, suq_serv *srv)
+{
+    if (j->state == run_error)
+    {
+        suq_serv_event(srv, j, "error", j->error_string);
+        joblist_re_place(jl, j);
+        return;
+    }
+    if (j->state != started)
+        return;
+
+    if (j->walltime > 0)
+    {
+        timer_add(&(srv->tw), &(j->timer), j->walltime*1000UL);
+    }
+    if (srv->st->sample_interval > 0 && !timer_active(&(srv->sample_timer)))
+    {
+        timer_add(&(srv->tw), &(srv->sample_timer), 
+                  srv->st->sample_interval*1000UL);
+    }
+    /* it can only gain in priority, so we won't see it again */
+    joblist_re_place(jl, j);
+    j->state = running;
+}
+
+/* check whether a job's memory request fits next to mem_running bytes */
+static int joblist_mem_fits(job *j, suq_serv *srv, long long mem_running)
+{
+    return (srv->cap.mem == 0 || mem_running + j->mem_max <= srv->cap.mem);
+}
+
+/* the fraction of a cpu that may be busy while we still count it as idle:
+   there is always some background activity. */
+#define SCAVENGER_IDLE_SLACK 0.25
+
+/* run, suspend and resume scavenger jobs. They may use the cpus that the 
+   regular jobs (taking n_running tasks) leave, as long as those are 
+   really idle and the memory (with mem_running bytes taken) suffices. */
+static void joblist_check_scavengers(joblist *jl, suq_serv *srv, 
+                                     int n_running, long long mem_running)
+{
+    int budget=suq_serv_ncpu(srv) - n_running;
+    double idle=srv->cpu_idle;
+    int used=0;
+    job *j;
+
+    /* if we haven't measured anything, all of the budget is idle */
+    if (idle < 0)
+        idle=budget;
+
+    j=joblist_first(jl);
+    while(j)
+    {
+        job *next=joblist_next(jl, j);
+        int width=job_width(j, srv->st->ntask);
+
+        if (!j->scavenger)
+        {
+            j=next;
+            continue;
+        }
+
+        if (j->state == running && !j->suspended)
+        {
+            /* the regular jobs come first. The list is in start order, so 
+               the last ones started are suspended first. */
+            if (used + width > budget)
+            {
+                printf("SERVER: suspending scavenger job %d (%s)\n", j->id, 
+                       j->name);
+                job_suspend(j);
+                suq_serv_event(srv, j, "suspended", NULL);
+            }
+            else
+                used += width;
+        }
+        else if (j->state == running && j->suspended)
+        {
+            if (used + width <= budget && width <= idle + SCAVENGER_IDLE_SLACK)
+            {
+                printf("SERVER: resuming scavenger job %d (%s)\n", j->id, 
+                       j->name);
+                job_resume(j);
+                suq_serv_event(srv, j, "resumed", NULL);
+                used += width;
+                idle -= width;
+            }
+        }
+        else if (j->state == waiting)
+        {
+            if (used + width <= budget && width <= idle + SCAVENGER_IDLE_SLACK
+                && joblist_mem_fits(j, srv, mem_running))
+            {
+                job_run(j, (jl->run_id)++, srv);
+                joblist_started(jl, j, srv);
+                if (j->state == running)
+                {
+                    mem_running += j->mem_max;
+                    used += width;
+                    idle -= width;
+                }
+            }
+        }
+        j=next;
+    }
+    /* until the next measurement, what we started isn't idle anymore */
+    if (srv->cpu_idle >= 0)
+        srv->cpu_idle=idle;
+}
+
 void joblist_check_run(joblist *jl, suq_serv *srv)
 {
     /* first check how many jobs are running */
     int n_running=0;
+    long long mem_running=0;
     job *j;
 
     if (debug>1)
@@ -285,9 +599,13 @@ void joblist_check_run(joblist *jl, suq_serv *srv)
         job *next=joblist_next(jl, j);
         char *loc;
 
+        if ((j->state == running || j->state == started) && !j->scavenger)
+        {
+            n_running += job_width(j, srv->st->ntask);
+        }
         if (j->state == running || j->state == started)
         {
-            n_running += j->ntask;
+            mem_running += j->mem_max;
         }
         if (j->state == started) 
         {
@@ -305,13 +623,37 @@ void joblist_check_run(joblist *jl, suq_serv *srv)
         }
         else if (j->state == done) 
         {
+            char exitstr[64];
+
+            if (j->cgroup)
+            {
+                cgroup_read_stat(j->cgroup, &(j->cgs));
+                cgroup_remove(j->cgroup);
+                free(j->cgroup);
+                j->cgroup=NULL;
+            }
+
             ctime_r(&(j->end_time), timestr);
             loc=strchr(timestr, '\n'); /* remove newline */
             if (loc)
                 *loc=0;
-            printf("%s: job %d (%s) finished\n", timestr, j->id, j->name);
-
-            joblist_remove(jl, j);
+            job_exit_string(j, exitstr, sizeof(exitstr));
+            suq_serv_event(srv, j, "finished", exitstr);
+            printf("%s: job %d (%s) finished: %s, user %.2f s, sys %.2f s, "
+                   "max rss %ld kB, blocks in/out %ld/%ld, "
+                   "cpu efficiency %.0f%%\n", timestr, j->id, j->name, 
+                   exitstr,
+                   j->ru.ru_utime.tv_sec + j->ru.ru_utime.tv_usec*1e-6,
+                   j->ru.ru_stime.tv_sec + j->ru.ru_stime.tv_usec*1e-6,
+                   j->ru.ru_maxrss, j->ru.ru_inblock, j->ru.ru_oublock,
+                   100.*job_cpu_efficiency(j, srv->st->ntask));
+            if (j->cgs.oom_kills > 0)
+                printf("%s: job %d (%s): %d processes killed by the OOM "
+                       "killer\n", timestr, j->id, j->name, j->cgs.oom_kills);
+
+            if (j->ncpus > 0)
+                cpu_alloc_release(&(srv->ca), j->id);
+            joblist_retire(jl, j);
         }
         j=next;
     }
@@ -328,28 +670,39 @@ void joblist_check_run(joblist *jl, suq_serv *srv)
         if (jntask <= 0)
             jntask = srv->st->ntask;
 
-        if ( j->state==waiting ) 
+        if ( j->state==waiting && !j->scavenger ) 
         {
-            if (n_running + jntask <= srv->st->ntask) 
+            if (n_running + jntask <= srv->st->ntask &&
+                joblist_mem_fits(j, srv, mem_running))
             {
-                job_run(j, (jl->run_id)++);
-                /* it can only gain in priority, so we won't see it again */
-                joblist_re_place(jl, j);
-                j->state = running;
+                job_run(j, (jl->run_id)++, srv);
+                joblist_started(jl, j, srv);
             }
             /* this makes the queue non-backfilling */
             n_running += jntask;
+            mem_running += j->mem_max;
         }
         if (j->state==waiting && (j->ntask > srv->st->ntask) )
         {
             j->state = resource_error;
             j->error_string = job_resource_error_string;
+            suq_serv_event(srv, j, "error", j->error_string);
 
             /* it doesn't matter if we look at it again */
             joblist_re_place(jl, j);
         }
+        else if (j->state==waiting && !joblist_mem_fits(j, srv, 0))
+        {
+            j->state = resource_error;
+            j->error_string = job_mem_error_string;
+            suq_serv_event(srv, j, "error", j->error_string);
+            joblist_re_place(jl, j);
+        }
         j=next;
     }
+
+    /* and fill up what's left with scavengers */
+    joblist_check_scavengers(jl, srv, n_running, mem_running);
 }
 
 
@@ -367,12 +720,14 @@ int joblist_check_ntask(joblist *jl, suq_serv *srv)
         {
             j->state = resource_error;
             j->error_string = job_resource_error_string;
+            suq_serv_event(srv, j, "error", j->error_string);
             ret=1;
             joblist_re_place(jl, j);
         }
         else if ( (j->state==resource_error) && (j->ntask <= srv->st->ntask))
         {
             j->state = waiting;
+            suq_serv_event(srv, j, "waiting", NULL);
             joblist_re_place(jl, j);
         }
         j=next;
@@ -392,6 +747,33 @@ void job_init(job *j)
     j->ntask=1;
     j->prio=0;
     j->id=0;
+    j->pid=0;
+    j->pidfd=-1;
+    event_source_init(&(j->pidfd_ev));
+    j->wd_fd=-1;
+    j->out_fd=-1;
+    j->walltime=0;
+    j->kill_state=0;
+    j->leader_done=0;
+    j->exit_status=0;
+    memset(&(j->ru), 0, sizeof(j->ru));
+    job_sample_init(&(j->smp));
+    j->nthread_over=0;
+    j->oversub=0;
+    j->ntask_acct=0;
+    j->ncpus=0;
+    CPU_ZERO(&(j->cpus));
+    j->no_env=0;
+    j->has_band=0;
+    j->scavenger=0;
+    j->suspended=0;
+    j->mem_max=0;
+    j->cgroup=NULL;
+    j->cgs.valid=0;
+    j->strays=NULL;
+    j->nstrays=0;
+    j->nstrays_alloc=0;
+    timer_init(&(j->timer), suq_serv_job_timer, j);
     j->state=waiting;
 }
 
@@ -401,6 +783,22 @@ void job_destroy(job *j)
     free(j->argv);
     free(j->envp);
     free(j->stdout_filename);
+    free(j->strays);
+    if (j->cgroup)
+    {
+        cgroup_remove(j->cgroup);
+        free(j->cgroup);
+    }
+    if (j->pidfd >= 0)
+    {
+        event_del(&(j->pidfd_ev));
+        close(j->pidfd);
+    }
+    if (j->wd_fd >= 0)
+        close(j->wd_fd);
+    if (j->out_fd >= 0)
+        close(j->out_fd);
+    timer_del(&(j->timer));
     /*if (j->error_string)
         free(j->error_string);*/
 }
@@ -424,6 +822,15 @@ void job_reinit(job *j)
     j->sub_time=time(NULL);
 }
 
+int job_width(job *j, int max_ntask)
+{
+    int ntask=(j->ntask > 0) ? j->ntask : max_ntask;
+
+    if (j->ntask_acct > ntask)
+        ntask=j->ntask_acct;
+    return ntask;
+}
+
 int job_gt(job *ja, job *jb)
 {
     /* The sort order is: 
@@ -464,7 +871,136 @@ int job_gt(job *ja, job *jb)
     return ja->id < jb->id;
 }
 
-void job_run(job *j, int run_order)
+/* check whether the job's environment sets variable name */
+static int job_env_has(job *j, const char *name)
+{
+    size_t len=strlen(name);
+    int i;
+
+    for(i=0;i<j->envc;i++)
+    {
+        if (strncmp(j->envp[i], name, len)==0 && j->envp[i][len]=='=')
+            return 1;
+    }
+    return 0;
+}
+
+/* add a variable to an environment under construction */
+static void job_env_add(char **envp, int *n, const char *name, 
+                        const char *val)
+{
+    size_t len=strlen(name)+strlen(val)+2;
+
+    envp[*n]=malloc_check_server(len);
+    snprintf(envp[*n], len, "%s=%s", name, val);
+    (*n)++;
+}
+
+/* make the environment for a job: the job's own variables, with the SUQ_ 
+   variables and the thread count knobs added. The thread count knobs
+   are only set if the job doesn't set them itself. The first *nown
+   entries point into the job; the rest must be freed. */
+static char **job_make_env(job *j, suq_serv *srv, int *nown)
+{
+    static const char *knobs[] = { "OMP_NUM_THREADS", "OPENBLAS_NUM_THREADS",
+                                   "MKL_NUM_THREADS", NULL };
+    char **envp;
+    char val[32];
+    char *cpus, *places;
+    size_t cpus_len, places_len;
+    int ntask=job_width(j, srv->st->ntask);
+    int mode=srv->st->job_env;
+    int n=0;
+    int i, c;
+
+    /* the SUQ_ variables may have been inherited from another job */
+    envp=malloc_check_server(sizeof(char*)*(j->envc+8));
+    for(i=0;i<j->envc;i++)
+    {
+        if (mode == JOB_ENV_NONE || j->no_env ||
+            (strncmp(j->envp[i], "SUQ_JOB_ID=", 11) != 0 &&
+             strncmp(j->envp[i], "SUQ_NTASK=", 10) != 0 &&
+             strncmp(j->envp[i], "SUQ_CPUS=", 9) != 0) )
+            envp[n++]=j->envp[i];
+    }
+    *nown=n;
+    if (mode == JOB_ENV_NONE || j->no_env)
+    {
+        envp[n]=NULL;
+        return envp;
+    }
+
+    snprintf(val, sizeof(val), "%d", j->id);
+    job_env_add(envp, &n, "SUQ_JOB_ID", val);
+    snprintf(val, sizeof(val), "%d", ntask);
+    job_env_add(envp, &n, "SUQ_NTASK", val);
+
+    /* the cpu list, as 0,1,2 and as {0},{1},{2} for OMP_PLACES */
+    cpus_len=j->ncpus*12+1;
+    places_len=j->ncpus*14+1;
+    cpus=malloc_check_server(cpus_len);
+    places=malloc_check_server(places_len);
+    cpus[0]=places[0]=0;
+    for(c=0;c<CPU_SETSIZE;c++)
+    {
+        if (CPU_ISSET(c, &(j->cpus)))
+        {
+            size_t l=strlen(cpus), pl=strlen(places);
+
+            snprintf(cpus+l, cpus_len-l, "%s%d", (l>0) ? "," : "", c);
+            snprintf(places+pl, places_len-pl, "%s{%d}", (pl>0) ? "," : "",
+                     c);
+        }
+    }
+    if (j->ncpus > 0)
+        job_env_add(envp, &n, "SUQ_CPUS", cpus);
+
+    if (mode == JOB_ENV_ALL)
+    {
+        for(i=0;knobs[i];i++)
+        {
+            if (!job_env_has(j, knobs[i]))
+                job_env_add(envp, &n, knobs[i], val);
+        }
+        if (j->ncpus > 0 && !job_env_has(j, "OMP_PLACES"))
+            job_env_add(envp, &n, "OMP_PLACES", places);
+    }
+    free(cpus);
+    free(places);
+    envp[n]=NULL;
+    return envp;
+}
+
+/* free an environment made by job_make_env */
+static void job_free_env(char **envp, int nown)
+{
+    int i=nown;
+
+    while(envp[i])
+        free(envp[i++]);
+    free(envp);
+}
+
+/* apply the scheduling settings of a band to the calling process. This
+   runs in the child, where there is nobody to report failures to; a job 
+   that can't be niced still runs. */
+static void job_set_sched(const prio_band *b)
+{
+    struct sched_param sp;
+
+    sp.sched_priority=0;
+    sched_setscheduler(0, b->policy, &sp);
+    setpriority(PRIO_PROCESS, 0, b->nice);
+#ifdef SYS_ioprio_set
+    if (b->ioclass != IOCLASS_NONE)
+    {
+        /* IOPRIO_WHO_PROCESS, with the class in the top bits */
+        syscall(SYS_ioprio_set, 1, 0, (b->ioclass << 13) | b->iolevel);
+    }
+#endif
+}
+
+void job_run(job *j, int run_order, suq_serv *srv)
 {
     pid_t ret;
     int stdo=-1,stdi=-1;
@@ -473,12 +1009,17 @@ void job_run(job *j, int run_order)
     char *pathname=NULL;
     char pathname_str[MAXPATHLEN];
     const char *error_string;
+    char **envp;
+    int nown;
 
     if (debug>0)
         printf("SERVER: RUNNING JOB %s\n", j->name);
 
     /* change directory. The parent will change back to / after fork() */
-    rret=chdir(j->wd);
+    if (j->wd_fd >= 0)
+        rret=fchdir(j->wd_fd);
+    else
+        rret=chdir(j->wd);
     if (rret != 0)
     {
         error_string="couldn't chdir to run directory";
@@ -487,8 +1028,11 @@ void job_run(job *j, int run_order)
 
     /* open stdout and stdin (which is /dev/null) */
     /*snprintf(stdout_filename,MAXPATHLEN, "%s.%d.out", j->name, j->id);*/
-    stdo=open(j->stdout_filename, O_WRONLY|O_CREAT|O_TRUNC, 
-              S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+    if (j->out_fd >= 0)
+        stdo=dup(j->out_fd);
+    else
+        stdo=open(j->stdout_filename, O_WRONLY|O_CREAT|O_TRUNC, 
+                  S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
     if (stdo<0)
     {
         error_string="couldn't open stdout";
@@ -501,6 +1045,33 @@ void job_run(job *j, int run_order)
         goto error;
     }
 
+    /* the cpus it may use, and its environment */
+    j->ncpus=cpu_alloc_get(&(srv->ca), j->id, job_width(j, srv->st->ntask),
+                           &(j->cpus));
+    envp=job_make_env(j, srv, &nown);
+    j->cgroup=cgroup_create(&(srv->cg), j->id, job_width(j, srv->st->ntask),
+                            j->mem_max);
+    {
+        const prio_band *b=suq_settings_get_band(srv->st, j->prio);
+
+        j->has_band=(b!=NULL);
+        if (b)
+            j->band=*b;
+        /* scavengers only get what nobody else wants */
+        if (j->scavenger)
+        {
+            if (!b)
+            {
+                j->band.max_prio=j->prio;
+                j->band.nice=19;
+            }
+            j->has_band=1;
+            j->band.policy=SCHED_IDLE;
+            j->band.ioclass=IOCLASS_IDLE;
+            j->band.iolevel=0;
+        }
+    }
+
     /* and now spawn the child process */
     ret=fork();
     if (ret<0)
@@ -512,6 +1083,19 @@ void job_run(job *j, int run_order)
         }
         else
         {
+            job_free_env(envp, nown);
+            cpu_alloc_release(&(srv->ca), j->id);
+            j->ncpus=0;
+            if (j->cgroup)
+            {
+                cgroup_remove(j->cgroup);
+                free(j->cgroup);
+                j->cgroup=NULL;
+            }
+            close(stdi);
+            close(stdo);
+            if (chdir("/") < 0)
+                server_system_error("chdir to / failed");
             return;
         }
     }
@@ -521,15 +1105,44 @@ void job_run(job *j, int run_order)
         if (chdir("/") < 0)
             server_system_error("chdir to / failed");
         j->pid=ret;
+        /* the pidfd is close-on-exec by default. If it fails, the SIGCHLD
+           path picks up the job. */
+        j->pidfd=job_pidfd_open(ret);
+        if (j->pidfd >= 0)
+        {
+            /* it wakes us up directly when the process exits */
+            event_add(&(srv->el), &(j->pidfd_ev), j->pidfd, EVENT_READ,
+                      suq_serv_pidfd_event, j);
+        }
+        if (debug>1 && j->pidfd < 0)
+            printf("SERVER: no pidfd for pid %d: %s\n", ret, strerror(errno));
         j->state=started;
         j->run_order=run_order;
+        {
+            char detail[32];
+            snprintf(detail, sizeof(detail), "pid %d", j->pid);
+            suq_serv_event(srv, j, "started", detail);
+        }
+        job_free_env(envp, nown);
         close(stdi);
         close(stdo);
+        /* the child has what it needs of the client's fds */
+        if (j->wd_fd >= 0)
+        {
+            close(j->wd_fd);
+            j->wd_fd=-1;
+        }
+        if (j->out_fd >= 0)
+        {
+            close(j->out_fd);
+            j->out_fd=-1;
+        }
 
         if (debug>0)
             printf("SERVER: pid=%d\n", ret);
 
         j->start_time=time(NULL);
+        gettimeofday(&(j->start_tv), NULL);
     }
     else
     {
@@ -539,6 +1152,17 @@ void job_run(job *j, int run_order)
            in one fell swoop. There's nothing much we can do if this fails,
            so we don't check return values. */
         setpgid(0, getpid());
+        if (j->cgroup)
+            cgroup_enter(j->cgroup, getpid());
+
+        /* the server blocks the signals it reads through its signal 
+           handler; the job should see them normally. */
+        sig_handler_child_reset();
+        /* jobs get the file limit we started with */
+        setrlimit(RLIMIT_NOFILE, &(srv->nofile));
+
+        if (j->has_band)
+            job_set_sched(&(j->band));
 
         /* take care of the stdin/out/err files */
         close(STDOUT_FILENO);
@@ -556,7 +1180,7 @@ void job_run(job *j, int run_order)
             /* if there's a slash in the command, we don't look in PATH */
             pathname=j->cmd;
 
-            execve(pathname, j->argv, j->envp);
+            execve(pathname, j->argv, envp);
         }
         else
         {
@@ -588,7 +1212,7 @@ void job_run(job *j, int run_order)
                 strncpy(pathname_str, path, len);
                 pathname_str[len]='/';
                 strncpy(pathname_str+len+1, j->cmd, MAXPATHLEN-len);
-                execve(pathname_str, j->argv, j->envp);
+                execve(pathname_str, j->argv, envp);
                 path=end+1;
             }
         }
@@ -614,18 +1238,202 @@ error:
         printf("SERVER: job %s ERROR: %s\n", j->name, j->error_string);
 }
 
-void job_cancel(job *j)
+/* send a signal to all processes of a job */
+static void job_signal(job *j, int sig)
+{
+    int i;
+
+    /* without a pid, killpg() would hit our own process group */
+    if (j->pid <= 0)
+        return;
+    if (killpg(j->pid, sig) < 0 && errno != ESRCH)
+        server_system_error("killpg");
+    /* the strays may have left the process group */
+    for(i=0;i<j->nstrays;i++)
+        kill(j->strays[i], sig);
+}
+
+void job_cancel(job *j, int sig)
 {
     if (debug>0)
-        printf("CANCELING JOB %s\n", j->name);
+        printf("CANCELING JOB %s (signal %d)\n", j->name, sig);
 
-    if (j->state == running)
+    if ((j->state == running || j->state == started) && j->pid > 0)
     {
-        killpg(j->pid, SIGTERM);
+        job_signal(j, sig);
+        if (sig == SIGKILL && j->cgroup)
+            cgroup_kill(j->cgroup);
+        /* a stopped job only sees the signal once it continues */
+        if (j->suspended)
+        {
+            job_signal(j, SIGCONT);
+            j->suspended=0;
+        }
+        j->kill_state++;
         /* we let the signal handler take care of the 
            cleanup here. */
     }
 }
 
+void job_suspend(job *j)
+{
+    if (j->state == running && !j->suspended)
+    {
+        job_signal(j, SIGSTOP);
+        j->suspended=1;
+    }
+}
+
+void job_resume(job *j)
+{
+    if (j->state == running && j->suspended)
+    {
+        job_signal(j, SIGCONT);
+        j->suspended=0;
+    }
+}
+
+int job_reap(job *j)
+{
+    pid_t ret;
+    int status;
+    struct rusage ru;
+
+    if (j->leader_done)
+        return 0;
+
+    ret=wait4(j->pid, &status, WNOHANG, &ru);
+    if (ret < 0 && errno != ECHILD)
+    {
+        server_system_error("wait4");
+        return 0;
+    }
+    if (ret == 0)
+        return 0;
 
+    if (debug>1)
+        printf("SERVER: CHILD pid=%d CAUGHT\n", j->pid);
 
+    j->leader_done=1;
+    if (ret > 0)
+    {
+        j->exit_status=status;
+        job_add_rusage(j, &ru);
+    }
+    else
+    {
+        /* someone else reaped it: we don't know how it went */
+        printf("SERVER: job %d (%s): pid %d was already reaped; its exit "
+               "status is unknown\n", j->id, j->name, j->pid);
+        j->exit_status=JOB_EXIT_UNKNOWN;
+    }
+    if (j->pidfd >= 0)
+    {
+        event_del(&(j->pidfd_ev));
+        close(j->pidfd);
+        j->pidfd=-1;
+    }
+    return 1;
+}
+
+void job_add_stray(job *j, pid_t pid)
+{
+    if (job_has_process(j, pid))
+        return;
+    if (j->nstrays >= j->nstrays_alloc)
+    {
+        j->nstrays_alloc = 2*j->nstrays_alloc + 4;
+        j->strays=realloc_check_server(j->strays, 
+                                       sizeof(pid_t)*j->nstrays_alloc);
+    }
+    j->strays[(j->nstrays)++]=pid;
+}
+
+int job_remove_stray(job *j, pid_t pid)
+{
+    int i;
+
+    for(i=0;i<j->nstrays;i++)
+    {
+        if (j->strays[i] == pid)
+        {
+            j->strays[i]=j->strays[--(j->nstrays)];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int job_has_process(job *j, pid_t pid)
+{
+    int i;
+
+    if (!j->leader_done && j->pid == pid)
+        return 1;
+    for(i=0;i<j->nstrays;i++)
+    {
+        if (j->strays[i] == pid)
+            return 1;
+    }
+    return 0;
+}
+
+int job_tree_alive(job *j)
+{
+    if (!j->leader_done || j->nstrays > 0)
+        return 1;
+    /* this also finds processes that we lost track of */
+    if (j->cgroup && cgroup_populated(j->cgroup) == 1)
+        return 1;
+    /* the rest of the process group, which we may not be the parent of */
+    if (killpg(j->pid, 0) == 0 || errno == EPERM)
+        return 1;
+    return 0;
+}
+
+void job_add_rusage(job *j, struct rusage *ru)
+{
+    timeradd(&(j->ru.ru_utime), &(ru->ru_utime), &(j->ru.ru_utime));
+    timeradd(&(j->ru.ru_stime), &(ru->ru_stime), &(j->ru.ru_stime));
+    if (ru->ru_maxrss > j->ru.ru_maxrss)
+        j->ru.ru_maxrss = ru->ru_maxrss;
+    j->ru.ru_minflt += ru->ru_minflt;
+    j->ru.ru_majflt += ru->ru_majflt;
+    j->ru.ru_inblock += ru->ru_inblock;
+    j->ru.ru_oublock += ru->ru_oublock;
+    j->ru.ru_nvcsw += ru->ru_nvcsw;
+    j->ru.ru_nivcsw += ru->ru_nivcsw;
+}
+
+double job_cpu_efficiency(job *j, int max_ntask)
+{
+    struct timeval end, wall;
+    double cpu, wallsec;
+    int ntask=(j->ntask > 0) ? j->ntask : max_ntask;
+
+    if (j->state == done)
+        end=j->end_tv;
+    else
+        gettimeofday(&end, NULL);
+    timersub(&end, &(j->start_tv), &wall);
+
+    wallsec=wall.tv_sec + wall.tv_usec*1e-6;
+    cpu=j->ru.ru_utime.tv_sec + j->ru.ru_utime.tv_usec*1e-6 +
+        j->ru.ru_stime.tv_sec + j->ru.ru_stime.tv_usec*1e-6;
+    if (wallsec <= 0 || ntask <= 0)
+        return 0;
+    return cpu/(ntask*wallsec);
+}
+
+void job_exit_string(job *j, char *str, size_t len)
+{
+    if (j->exit_status == JOB_EXIT_UNKNOWN)
+        snprintf(str, len, "unknown exit status");
+    else if (WIFSIGNALED(j->exit_status))
+        snprintf(str, len, "killed by signal %d", WTERMSIG(j->exit_status));
+    else if (WIFEXITED(j->exit_status))
+        snprintf(str, len, "exited with status %d", 
+                 WEXITSTATUS(j->exit_status));
+    else
+        snprintf(str, len, "unknown exit status");
+}
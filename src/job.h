@@ -34,9 +34,22 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "connection.h"
 #include "wait.h"
+#include "timer.h"
+#include "sample.h"
+#include "cpualloc.h"
+#include "settings.h"
+#include "cgroup.h"
+#include "event.h"
+
+#include <sys/time.h>
+#include <sys/resource.h>
 
 extern const char *job_state_strings[];
 
+/* the exit status of a job whose main process we couldn't wait for. No
+   wait() status looks like this. */
+#define JOB_EXIT_UNKNOWN (-1)
+
 typedef struct job
 {
     int id; /* job id */
@@ -45,6 +58,16 @@ typedef struct job
     
     int ntask; /* the number of processors used */
 
+    int walltime; /* the maximum run time in seconds, or 0 for no limit */
+    prio_band band; /* the scheduling band it was started in */
+    int has_band; /* whether it was started in a scheduling band */
+    long long mem_max; /* the memory limit in bytes, or 0 for none */
+    char *cgroup; /* the job's cgroup, or NULL */
+    cgroup_stat cgs; /* the accounting from its cgroup, once it's done */
+    int scavenger; /* whether it only runs on otherwise idle cpus */
+    int suspended; /* whether it is stopped to make room for others */
+    int no_env; /* whether to leave the environment vars as they are */
+
 
     char *name; /* job name */
     char *wd; /* the working directory */
@@ -55,9 +78,29 @@ typedef struct job
     char **envp; /* the environment vars */ 
 
     char *stdout_filename; /* the filename for stdout+stderr (relative to wd) */
+    int wd_fd; /* the working directory passed by the client, or -1 */
+    int out_fd; /* the stdout+stderr file passed by the client, or -1 */
 
     /* run params */
     pid_t pid; /* process id */
+    int pidfd; /* pidfd referring to pid, or -1 if not available */
+    event_source pidfd_ev; /* the pidfd's registration with the event loop */
+
+    int leader_done; /* whether the main process (pid) has exited */
+    pid_t *strays; /* descendants that were re-parented to us */
+    int nstrays; /* the number of strays */
+    int nstrays_alloc; /* the allocated number of strays */
+
+    job_sample smp; /* live resource usage samples */
+    int nthread_over; /* consecutive samples with more threads than ntask */
+    int oversub; /* whether the job is flagged for using too many threads */
+    int ntask_acct; /* the number of tasks it is accounted for instead of 
+                       ntask, or 0 */
+    cpu_set_t cpus; /* the cpus allocated to the job */
+    int ncpus; /* the number of cpus allocated to the job, or 0 */
+
+    suq_timer timer; /* the walltime and kill escalation timer */
+    int kill_state; /* the number of kill signals sent so far */
 
     /* job state. Must match job_state_strings */
     enum job_state 
@@ -74,6 +117,12 @@ typedef struct job
     time_t sub_time; /* time at which the job was submitted */
     time_t start_time; /* time at which the job was started */
     time_t end_time; /* time at which the job was finished */
+    struct timeval start_tv; /* precise start time */
+    struct timeval end_tv; /* precise end time */
+
+    int exit_status; /* the wait() status of the main process, or 
+                        JOB_EXIT_UNKNOWN */
+    struct rusage ru; /* the summed resource usage of the job's processes */
        
     char *error_string;    
 
@@ -95,6 +144,12 @@ typedef struct
 
     int run_id; /* the run id for the next job */
 
+    job *done_head; /* head of the list of recently finished jobs, most 
+                       recent first - a dummy element */
+    int Ndone; /* the number of recently finished jobs */
+
+    job done_head_elem; /* the pre-allocated finished list head element */
+
     jobwait *wait_head; /* head of the wait list - a dummy element */
 
     jobwait wait_head_elem; /* pre-allocated wait head element */
@@ -114,6 +169,9 @@ void joblist_add(joblist *jl, job *j);
 /* remove a job from the list */
 void joblist_remove(joblist *jl, job *j);
 
+/* move a finished job from the list to the list of recently finished jobs */
+void joblist_retire(joblist *jl, job *j);
+
 /* give a job a new place on the list based on its new state. */
 void joblist_re_place(joblist *jl, job *j);
 
@@ -139,6 +197,13 @@ jobwait *joblist_wait_search_conn(joblist *jl, connection *cn);
 /* get the number of jobs in the list */
 int joblist_N(joblist *jl);
 
+/* sample the live resource usage of all running jobs from /proc */
+void joblist_sample(joblist *jl);
+
+/* flag running jobs that use more threads than their ntask, and apply the 
+   oversubscription policy to them */
+void joblist_check_oversub(joblist *jl, struct suq_serv *srv);
+
 /* check whether we can run any jobs, and run them.  */
 void joblist_check_run(joblist *jl, struct suq_serv *srv);
 
@@ -154,6 +219,11 @@ job *joblist_first(joblist *jl);
 /* get the next-hightest-priority job, or NULL when there's no jobs left */
 job *joblist_next(joblist *jl, job *j);
 
+/* get the most recently finished job, or NULL if there's none */
+job *joblist_done_first(joblist *jl);
+/* get the next most recently finished job, or NULL */
+job *joblist_done_next(joblist *jl, job *j);
+
 
 
 
@@ -162,14 +232,50 @@ void job_init(job *j);
 /* destroy a job */
 void job_destroy(job *j);
 
+/* get the number of tasks the job counts for. max_ntask is the ntask that 
+   blocking jobs count as. */
+int job_width(job *j, int max_ntask);
+
 /* returns 1 if ja has higher run priority than jb */
 int job_gt(job *ja, job *jb);
 
 /* run a job */
-void job_run(job *j, int run_id);
+void job_run(job *j, int run_id, struct suq_serv *srv);
+
+/* stop a running job with SIGSTOP */
+void job_suspend(job *j);
+
+/* continue a job stopped with job_suspend */
+void job_resume(job *j);
+
+/* cancel a job if it's running, by sending its process group sig */
+void job_cancel(job *j, int sig);
+
+/* reap a job's main process if it has exited. Returns 1 if it was reaped, 
+   0 if it is still running. */
+int job_reap(job *j);
+
+/* add a descendant process that was re-parented to us */
+void job_add_stray(job *j, pid_t pid);
+
+/* remove a descendant after it was reaped. Returns 1 if it was found */
+int job_remove_stray(job *j, pid_t pid);
+
+/* check whether a process belongs to the job's tree */
+int job_has_process(job *j, pid_t pid);
+
+/* check whether any process of the job's tree is still alive */
+int job_tree_alive(job *j);
+
+/* add the resource usage of a reaped process to the job */
+void job_add_rusage(job *j, struct rusage *ru);
+
+/* get the job's CPU time divided by its ntask times its wall clock time. 
+   max_ntask is the ntask that blocking jobs count as. */
+double job_cpu_efficiency(job *j, int max_ntask);
 
-/* cancel a job if it's running */
-void job_cancel(job *j);
+/* print a description of the job's exit status into str */
+void job_exit_string(job *j, char *str, size_t len);
 
 /* recycle  */
 void job_reinit(job *j);
@@ -0,0 +1,588 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "err.h"
+#include "settings.h"
+#include "job.h"
+#include "server.h"
+#include "protocol.h"
+#include "journal.h"
+
+
+/* the OPT fields of a record */
+typedef struct journal_rec
+{
+    const char *op; /* the operation */
+    int id;
+    int prio;
+    int ntask;
+    int walltime;
+    long long mem;
+    int scavenger;
+    int noenv;
+    time_t subtime;
+    const char *out; /* the output file name, or NULL */
+    int next; /* the last job id, for base records */
+} journal_rec;
+
+
+/* make sure there's room for len more bytes of records */
+static void journal_reserve(journal *jn, size_t len)
+{
+    if (jn->len + len <= jn->alloc)
+        return;
+    while(jn->len + len > jn->alloc)
+        jn->alloc = (jn->alloc > 0) ? 2*jn->alloc : 4096;
+    jn->buf=realloc_check_server(jn->buf, jn->alloc);
+}
+
+/* finish a record, and add it to the records to write */
+static void journal_append(journal *jn, proto_frame *pf)
+{
+    proto_frame_finish(pf);
+    journal_reserve(jn, pf->len);
+    memcpy(jn->buf + jn->len, pf->buf, pf->len);
+    jn->len += pf->len;
+    jn->nrecords++;
+    proto_frame_destroy(pf);
+}
+
+/* add an OPT field name=val to a record */
+static void journal_add_opt(proto_frame *pf, const char *name, long long val)
+{
+    char str[64];
+
+    snprintf(str, sizeof(str), "%s=%lld", name, val);
+    proto_frame_add_string(pf, PROTO_FIELD_OPT, str);
+}
+
+/* add the record of a job's submission, with everything to restore it */
+static void journal_add_submit(journal *jn, job *j)
+{
+    proto_frame pf;
+    char out[MAXPATHLEN+8];
+    int i;
+
+    proto_frame_init(&pf, 0);
+    proto_frame_add_string(&pf, PROTO_FIELD_OPT, "op=submit");
+    journal_add_opt(&pf, "id", j->id);
+    journal_add_opt(&pf, "prio", j->prio);
+    journal_add_opt(&pf, "ntask", j->ntask);
+    journal_add_opt(&pf, "walltime", j->walltime);
+    journal_add_opt(&pf, "mem", j->mem_max);
+    journal_add_opt(&pf, "scavenger", j->scavenger);
+    journal_add_opt(&pf, "noenv", j->no_env);
+    journal_add_opt(&pf, "subtime", (long long)j->sub_time);
+    snprintf(out, sizeof(out), "out=%s", j->stdout_filename);
+    proto_frame_add_string(&pf, PROTO_FIELD_OPT, out);
+    proto_frame_add_string(&pf, PROTO_FIELD_WD, j->wd);
+    for(i=0;i<j->argc;i++)
+        proto_frame_add_string(&pf, PROTO_FIELD_ARG, j->argv[i]);
+    for(i=0;i<j->envc;i++)
+        proto_frame_add_string(&pf, PROTO_FIELD_ENV, j->envp[i]);
+    journal_append(jn, &pf);
+}
+
+/* add a record of an operation on the job with id */
+static void journal_add_op(journal *jn, const char *op, int id, 
+                           const char *name, long long val)
+{
+    proto_frame pf;
+    char str[32];
+
+    proto_frame_init(&pf, 0);
+    snprintf(str, sizeof(str), "op=%s", op);
+    proto_frame_add_string(&pf, PROTO_FIELD_OPT, str);
+    if (id > 0)
+        journal_add_opt(&pf, "id", id);
+    if (name)
+        journal_add_opt(&pf, name, val);
+    journal_append(jn, &pf);
+}
+
+/* write len bytes of buf to fd. Returns 0 on success */
+static int journal_write(int fd, const char *buf, size_t len)
+{
+    while(len > 0)
+    {
+        ssize_t res=write(fd, buf, len);
+
+        if (res < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += res;
+        len -= res;
+    }
+    return 0;
+}
+
+/* give up on the journal after an error; the queue goes on without it */
+static void journal_fail(journal *jn, const char *message)
+{
+    server_system_error(message);
+    printf("SERVER: journal: jobs will not be restored after a crash\n");
+    close(jn->fd);
+    jn->fd=-1;
+    jn->len=0;
+}
+
+/* sync the directory the journal is in, after a rename */
+static void journal_sync_dir(journal *jn)
+{
+    char dirname[MAXPATHLEN];
+    char *slash;
+    int fd;
+
+    snprintf(dirname, sizeof(dirname), "%s", jn->filename);
+    slash=strrchr(dirname, '/');
+    if (!slash)
+        return;
+    *slash=0;
+    fd=open(dirname, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if (fd < 0)
+        return;
+    if (fsync(fd) < 0)
+        server_system_error("journal: fsync of its directory");
+    close(fd);
+}
+
+
+
+void journal_init(journal *jn, const char *filename)
+{
+    jn->filename=strdup(filename);
+    jn->tmpname=malloc_check_server(strlen(filename)+5);
+    sprintf(jn->tmpname, "%s.tmp", filename);
+    jn->buf=NULL;
+    jn->len=0;
+    jn->alloc=0;
+    jn->nrecords=0;
+    jn->replaying=0;
+
+    jn->fd=open(filename, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 
+                S_IRUSR|S_IWUSR);
+    if (jn->fd < 0)
+    {
+        server_system_error("journal: open");
+        printf("SERVER: journal: jobs will not be restored after a crash\n");
+    }
+}
+
+void journal_destroy(journal *jn)
+{
+    if (jn->fd >= 0)
+    {
+        if (jn->len > 0 && journal_write(jn->fd, jn->buf, jn->len) < 0)
+            server_system_error("journal: write");
+        else if (jn->len > 0 && fdatasync(jn->fd) < 0)
+            server_system_error("journal: fdatasync");
+        close(jn->fd);
+        jn->fd=-1;
+    }
+    free(jn->buf);
+    free(jn->filename);
+    free(jn->tmpname);
+    jn->buf=NULL;
+    jn->filename=jn->tmpname=NULL;
+}
+
+int journal_pending(journal *jn)
+{
+    return jn->len > 0;
+}
+
+void journal_event(journal *jn, job *j, const char *event)
+{
+    if (jn->fd < 0 || jn->replaying)
+        return;
+
+    if (strcmp(event, "submitted")==0)
+        journal_add_submit(jn, j);
+    else if (strcmp(event, "priority")==0)
+        journal_add_op(jn, "prio", j->id, "prio", j->prio);
+    else if (strcmp(event, "started")==0)
+        journal_add_op(jn, "start", j->id, NULL, 0);
+    else if (strcmp(event, "finished")==0 || strcmp(event, "deleted")==0)
+        journal_add_op(jn, "end", j->id, NULL, 0);
+}
+
+void journal_sync(journal *jn, suq_serv *cs)
+{
+    if (jn->fd < 0 || jn->len == 0)
+        return;
+
+    if (journal_write(jn->fd, jn->buf, jn->len) < 0)
+    {
+        journal_fail(jn, "journal: write");
+        return;
+    }
+    if (fdatasync(jn->fd) < 0)
+    {
+        journal_fail(jn, "journal: fdatasync");
+        return;
+    }
+    if (debug>1)
+        printf("SERVER: journal: synced %lu bytes\n", (unsigned long)jn->len);
+    jn->len=0;
+
+    if (jn->nrecords > JOURNAL_COMPACT_MIN &&
+        jn->nrecords > JOURNAL_COMPACT_RATIO*joblist_N(&(cs->jl)))
+        journal_compact(jn, cs);
+}
+
+void journal_compact(journal *jn, suq_serv *cs)
+{
+    char *old_buf=jn->buf; /* the records we'd write otherwise */
+    size_t old_len=jn->len, old_alloc=jn->alloc;
+    int old_nrecords=jn->nrecords;
+    job *j;
+    int fd;
+
+    if (jn->fd < 0)
+        return;
+
+    /* the new journal has what the pending records would have added */
+    jn->buf=NULL;
+    jn->len=jn->alloc=0;
+    jn->nrecords=0;
+    journal_add_op(jn, "base", 0, "next", cs->st->next_id);
+    j=joblist_first(&(cs->jl));
+    while(j)
+    {
+        journal_add_submit(jn, j);
+        if (j->state == started || j->state == running)
+            journal_add_op(jn, "start", j->id, NULL, 0);
+        j=joblist_next(&(cs->jl), j);
+    }
+
+    fd=open(jn->tmpname, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND|O_CLOEXEC, 
+            S_IRUSR|S_IWUSR);
+    if (fd < 0 || journal_write(fd, jn->buf, jn->len) < 0 || 
+        fdatasync(fd) < 0 || rename(jn->tmpname, jn->filename) < 0)
+    {
+        /* we keep the old one */
+        server_system_error("journal: compacting");
+        if (fd >= 0)
+        {
+            close(fd);
+            unlink(jn->tmpname);
+        }
+        free(jn->buf);
+        jn->buf=old_buf;
+        jn->len=old_len;
+        jn->alloc=old_alloc;
+        jn->nrecords=old_nrecords;
+        return;
+    }
+    journal_sync_dir(jn);
+    if (debug>1)
+        printf("SERVER: journal: compacted %d records to %d\n", 
+               old_nrecords, jn->nrecords);
+
+    close(jn->fd);
+    jn->fd=fd;
+    jn->len=0;
+    free(old_buf);
+}
+
+
+
+/* find the job with id in the queue */
+static job *journal_find_job(suq_serv *cs, int id)
+{
+    job *j=joblist_first(&(cs->jl));
+
+    while(j && j->id != id)
+        j=joblist_next(&(cs->jl), j);
+    return j;
+}
+
+/* get the value of an OPT field called name, or NULL */
+static const char *journal_opt(const char *value, const char *name)
+{
+    size_t len=strlen(name);
+
+    if (strncmp(value, name, len)==0 && value[len]=='=')
+        return value+len+1;
+    return NULL;
+}
+
+/* read the OPT fields of a record into rec. Returns -1 if the record is
+   malformed. */
+static int journal_read_opts(const char *buf, size_t len, journal_rec *rec)
+{
+    size_t pos=0;
+    int type;
+    const char *value;
+    size_t vlen;
+    int ret;
+
+    memset(rec, 0, sizeof(journal_rec));
+    while( (ret=proto_frame_next_field(buf, len, &pos, &type, &value, 
+                                       &vlen)) > 0)
+    {
+        const char *v;
+
+        /* all the fields we know are strings, nul included */
+        if (vlen == 0 || value[vlen-1] != 0)
+            return -1;
+        if (type != PROTO_FIELD_OPT)
+            continue;
+        if ( (v=journal_opt(value, "op")) )
+            rec->op=v;
+        else if ( (v=journal_opt(value, "id")) )
+            rec->id=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "prio")) )
+            rec->prio=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "ntask")) )
+            rec->ntask=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "walltime")) )
+            rec->walltime=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "mem")) )
+            rec->mem=strtoll(v, NULL, 10);
+        else if ( (v=journal_opt(value, "scavenger")) )
+            rec->scavenger=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "noenv")) )
+            rec->noenv=strtol(v, NULL, 10);
+        else if ( (v=journal_opt(value, "subtime")) )
+            rec->subtime=strtoll(v, NULL, 10);
+        else if ( (v=journal_opt(value, "out")) )
+            rec->out=v;
+        else if ( (v=journal_opt(value, "next")) )
+            rec->next=strtol(v, NULL, 10);
+    }
+    if (ret < 0 || !rec->op)
+        return -1;
+    return 0;
+}
+
+/* restore a submitted job from its record */
+static void journal_replay_submit(suq_serv *cs, const char *rbuf, size_t len,
+                                  journal_rec *rec)
+{
+    job *j=malloc_check_server(sizeof(job));
+    size_t pos=0;
+    int type;
+    const char *value;
+    size_t vlen;
+
+    job_init(j);
+    /* like a request, the job keeps the record, and points into it */
+    j->buf=malloc_check_server(len);
+    memcpy(j->buf, rbuf, len);
+    j->wd=NULL;
+    j->argc=j->envc=0;
+    while(proto_frame_next_field(j->buf, len, &pos, &type, &value, &vlen) > 0)
+    {
+        if (type == PROTO_FIELD_WD)
+            j->wd=(char*)value;
+        else if (type == PROTO_FIELD_ARG)
+            j->argc++;
+        else if (type == PROTO_FIELD_ENV)
+            j->envc++;
+    }
+    if (!j->wd || j->argc < 1 || journal_find_job(cs, rec->id))
+    {
+        printf("SERVER: journal: can't restore job %d\n", rec->id);
+        free(j->buf);
+        free(j);
+        return;
+    }
+    j->argv=malloc_check_server(sizeof(char*)*(j->argc+1));
+    j->envp=malloc_check_server(sizeof(char*)*(j->envc+1));
+    j->argc=j->envc=0;
+    pos=0;
+    while(proto_frame_next_field(j->buf, len, &pos, &type, &value, &vlen) > 0)
+    {
+        if (type == PROTO_FIELD_ARG)
+            j->argv[j->argc++]=(char*)value;
+        else if (type == PROTO_FIELD_ENV)
+            j->envp[j->envc++]=(char*)value;
+    }
+    j->argv[j->argc]=NULL;
+    j->envp[j->envc]=NULL;
+    j->cmd=j->argv[0];
+
+    j->id=rec->id;
+    j->prio=rec->prio;
+    j->ntask=rec->ntask;
+    j->walltime=rec->walltime;
+    j->mem_max=rec->mem;
+    j->scavenger=rec->scavenger;
+    j->no_env=rec->noenv;
+    job_reinit(j);
+    j->sub_time=rec->subtime;
+    if (rec->out)
+        snprintf(j->stdout_filename, MAXPATHLEN, "%s", rec->out);
+
+    j->state=waiting;
+    joblist_add(&(cs->jl), j);
+    /* the next job gets the next id */
+    cs->st->next_id=j->id;
+}
+
+/* apply one record */
+static void journal_replay_record(suq_serv *cs, const char *buf, size_t len)
+{
+    journal_rec rec;
+    job *j;
+
+    if (journal_read_opts(buf, len, &rec) < 0)
+    {
+        printf("SERVER: journal: skipping a malformed record\n");
+        return;
+    }
+    if (strcmp(rec.op, "base")==0)
+    {
+        cs->st->next_id=rec.next;
+    }
+    else if (strcmp(rec.op, "submit")==0)
+    {
+        journal_replay_submit(cs, buf, len, &rec);
+    }
+    else if ( (j=journal_find_job(cs, rec.id)) )
+    {
+        if (strcmp(rec.op, "prio")==0)
+        {
+            j->prio=rec.prio;
+            joblist_re_place(&(cs->jl), j);
+        }
+        else if (strcmp(rec.op, "start")==0)
+        {
+            /* not running: we just know it was started */
+            j->state=started;
+            joblist_re_place(&(cs->jl), j);
+        }
+        else if (strcmp(rec.op, "end")==0)
+        {
+            joblist_remove(&(cs->jl), j);
+        }
+    }
+}
+
+int journal_replay(journal *jn, suq_serv *cs)
+{
+    struct stat sb;
+    char *data;
+    size_t size;
+    size_t pos=0;
+    int nrecords=0;
+    int n=0;
+    job *j;
+
+    if (jn->fd < 0)
+        return 0;
+    if (fstat(jn->fd, &sb) < 0)
+    {
+        journal_fail(jn, "journal: fstat");
+        return 0;
+    }
+    size=sb.st_size;
+    if (size == 0)
+        return 0;
+
+    data=malloc_check_server(size);
+    if (pread(jn->fd, data, size, 0) != (ssize_t)size)
+    {
+        free(data);
+        journal_fail(jn, "journal: read");
+        return 0;
+    }
+
+    jn->replaying=1;
+    while(pos < size)
+    {
+        size_t frame_len;
+
+        if (proto_frame_check(data+pos, size-pos, &frame_len) < 0 ||
+            frame_len == 0 || frame_len > size-pos)
+            break;
+        journal_replay_record(cs, data+pos, frame_len);
+        pos += frame_len;
+        nrecords++;
+    }
+    jn->replaying=0;
+    jn->nrecords=nrecords;
+    free(data);
+    if (pos < size)
+    {
+        /* a record that didn't make it to disk whole */
+        printf("SERVER: journal: cutting off %lu bytes of a torn record\n",
+               (unsigned long)(size-pos));
+        if (ftruncate(jn->fd, pos) < 0)
+            journal_fail(jn, "journal: ftruncate");
+    }
+
+    /* the jobs that were running when the last server stopped may still
+       be running, without us: we don't start them again */
+    j=joblist_first(&(cs->jl));
+    while(j)
+    {
+        job *next=joblist_next(&(cs->jl), j);
+
+        if (j->state == started)
+        {
+            printf("SERVER: journal: job %d (%s) was running when the "
+                   "last queuer stopped; it is not started again\n", 
+                   j->id, j->name);
+            joblist_remove(&(cs->jl), j);
+        }
+        else
+        {
+            n++;
+        }
+        j=next;
+    }
+    if (n > 0)
+        printf("SERVER: journal: restored %d waiting jobs\n", n);
+
+    /* start from a clean journal */
+    journal_compact(jn, cs);
+    return n;
+}
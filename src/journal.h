@@ -0,0 +1,109 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stddef.h>
+
+/* The job journal: the daemon appends a record to it for every job that
+   is submitted, re-prioritized, started or ended, so that the jobs in 
+   the queue survive a crash or a reboot. A new daemon replays it to get 
+   them back.
+
+   Every record is a frame in the request wire format (see protocol.h),
+   with the job's working directory, arguments and environment as WD, 
+   ARG and ENV fields, and everything else as OPT fields. The first OPT
+   field is the operation:
+
+   op=base     the start of a compacted journal, with next=<last job id>
+   op=submit   a new job: id, prio, ntask, walltime, mem, scavenger, 
+               noenv, subtime, out, and the WD, ARG and ENV fields
+   op=prio     the job with id has a new prio
+   op=start    the job with id was started
+   op=end      the job with id is gone: finished, deleted, or dropped 
+
+   Records are collected during a round of the event loop and written 
+   and synced together at its end (group commit); the replies that 
+   confirm them are sent after that. Once the journal has many more 
+   records than there are jobs, it is rewritten with only the jobs that
+   are left. A torn record at the end, from a crash during a write, is
+   cut off. */
+
+/* compact once there are this many records, and ... */
+#define JOURNAL_COMPACT_MIN 1024
+/* ... this many times as many as there are jobs */
+#define JOURNAL_COMPACT_RATIO 4
+
+typedef struct journal
+{
+    int fd; /* the journal file, or -1 if we don't keep one */
+    char *filename;
+    char *tmpname; /* the name of the new file while compacting */
+
+    char *buf; /* the records that are not written yet */
+    size_t len; /* their length */
+    size_t alloc; /* the allocated size of buf */
+
+    int nrecords; /* the number of records in the file and in buf */
+    int replaying; /* whether we're replaying, and shouldn't add records */
+} journal;
+
+struct suq_serv;
+struct job;
+
+
+/* open the journal in filename, creating it if it isn't there. Without
+   it, the daemon goes on without a journal. */
+void journal_init(journal *jn, const char *filename);
+
+/* write what's left and close the journal */
+void journal_destroy(journal *jn);
+
+/* read the journal, and add the jobs that are still waiting to the job 
+   list. Jobs that were running are not started again. Returns the number
+   of jobs restored. */
+int journal_replay(journal *jn, struct suq_serv *cs);
+
+/* add the record for a job event (see suq_serv_event()), if the event 
+   changes what we'd restore */
+void journal_event(journal *jn, struct job *j, const char *event);
+
+/* whether there are records that are not on disk yet */
+int journal_pending(journal *jn);
+
+/* write and sync the pending records, and compact the journal if it has
+   grown too much */
+void journal_sync(journal *jn, struct suq_serv *cs);
+
+/* rewrite the journal with only the jobs that are in the queue now */
+void journal_compact(journal *jn, struct suq_serv *cs);
+
+#endif /* __JOURNAL_H__ */
@@ -118,21 +118,37 @@ int main(int argc, char *argv[])
 
     if (detach)
     {
+        if (client_snapshot_print(&st, argc, argv))
+        {
+            /* answered from the snapshot: no need to bother the daemon */
+            suq_settings_destroy(&st);
+            return errcode;
+        }
         /* connect to an already existing daemon, or spawn a new one */
         client_connection_init(&cc, &st);
-        /* the client is stupid: the daemon does all the work, including
-           parsing the command line. */
-        client_connection_send_request(&cc, argc, argv);
+        if (argc > 1 && strcmp(argv[1], "batch")==0)
+        {
+            /* many commands over one connection */
+            int show_tags=(argc > 2 && strcmp(argv[2], "-t")==0);
+
+            client_connection_batch(&cc, argv[0], show_tags, &errcode);
+        }
+        else
+        {
+            /* the client is stupid: the daemon does all the work, including
+               parsing the command line. */
+            client_connection_send_request(&cc, argc, argv);
 
-        /* we just read back the results */
-        client_connection_get_print_results(&cc, &errcode);
+            /* we just read back the results */
+            client_connection_get_print_results(&cc, &errcode);
+        }
         /* and close the connection */
         client_connection_destroy(&cc);
     }
     else
     {
         /* we just start the server main */
-        suq_serv_main(&st, -1, -1);
+        suq_serv_main(&st, -1, -1, -1);
     }
     suq_settings_destroy(&st);
 
@@ -0,0 +1,167 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "err.h"
+#include "protocol.h"
+
+
+/* make sure there's room for len more bytes */
+static void proto_frame_reserve(proto_frame *pf, size_t len)
+{
+    if (pf->len + len > pf->alloc)
+    {
+        while(pf->len + len > pf->alloc)
+            pf->alloc *= 2;
+        pf->buf=realloc_check(pf->buf, pf->alloc);
+    }
+}
+
+void proto_put_header(char *buf, int flags, size_t length)
+{
+    uint16_t version=PROTO_VERSION;
+    uint16_t hflags=flags;
+    uint32_t hlength=length;
+
+    memcpy(buf, PROTO_MAGIC, PROTO_MAGIC_SIZE);
+    memcpy(buf+4, &version, sizeof(version));
+    memcpy(buf+6, &hflags, sizeof(hflags));
+    memcpy(buf+8, &hlength, sizeof(hlength));
+}
+
+void proto_put_field_header(char *buf, int type, size_t len)
+{
+    uint16_t ftype=type;
+    uint16_t reserved=0;
+    uint32_t flen=len;
+
+    memcpy(buf, &ftype, sizeof(ftype));
+    memcpy(buf+2, &reserved, sizeof(reserved));
+    memcpy(buf+4, &flen, sizeof(flen));
+}
+
+int proto_frame_flags(const char *buf)
+{
+    uint16_t flags;
+
+    memcpy(&flags, buf+6, sizeof(flags));
+    return flags;
+}
+
+void proto_frame_init(proto_frame *pf, int flags)
+{
+    pf->alloc=1024;
+    pf->buf=malloc_check(pf->alloc);
+    /* the length goes in when we're done */
+    proto_put_header(pf->buf, flags, 0);
+    pf->len=PROTO_HEADER_SIZE;
+}
+
+void proto_frame_destroy(proto_frame *pf)
+{
+    free(pf->buf);
+    pf->buf=NULL;
+    pf->len=pf->alloc=0;
+}
+
+void proto_frame_add_string(proto_frame *pf, int type, const char *str)
+{
+    size_t flen=strlen(str)+1;
+
+    proto_frame_reserve(pf, PROTO_FIELD_HEADER_SIZE + flen);
+    proto_put_field_header(pf->buf+pf->len, type, flen);
+    memcpy(pf->buf+pf->len+PROTO_FIELD_HEADER_SIZE, str, flen);
+    pf->len += PROTO_FIELD_HEADER_SIZE + flen;
+}
+
+void proto_frame_finish(proto_frame *pf)
+{
+    uint32_t length=pf->len - PROTO_HEADER_SIZE;
+
+    memcpy(pf->buf+8, &length, sizeof(length));
+}
+
+int proto_frame_check(const char *buf, size_t len, size_t *frame_len)
+{
+    uint16_t version;
+    uint32_t length;
+
+    *frame_len=0;
+    /* check what we have of the magic */
+    if (memcmp(buf, PROTO_MAGIC, len<PROTO_MAGIC_SIZE ? len : 
+                                                        PROTO_MAGIC_SIZE)!=0)
+        return -1;
+    if (len < PROTO_HEADER_SIZE)
+        return 0;
+
+    memcpy(&version, buf+4, sizeof(version));
+    memcpy(&length, buf+8, sizeof(length));
+    if (version != PROTO_VERSION)
+        return -1;
+    if (length > PROTO_MAX_LENGTH)
+        return -1;
+    *frame_len=PROTO_HEADER_SIZE + length;
+    return 0;
+}
+
+int proto_frame_next_field(const char *buf, size_t frame_len, size_t *pos,
+                           int *type, const char **value, size_t *len)
+{
+    uint16_t ftype;
+    uint32_t flen;
+
+    if (*pos == 0)
+        *pos=PROTO_HEADER_SIZE;
+    if (*pos == frame_len)
+        return 0;
+    if (frame_len - *pos < PROTO_FIELD_HEADER_SIZE)
+        return -1;
+
+    memcpy(&ftype, buf + *pos, sizeof(ftype));
+    memcpy(&flen, buf + *pos + 4, sizeof(flen));
+    *pos += PROTO_FIELD_HEADER_SIZE;
+    if (flen > frame_len - *pos)
+        return -1;
+
+    *type=ftype;
+    *value=buf + *pos;
+    *len=flen;
+    *pos += flen;
+    return 1;
+}
+
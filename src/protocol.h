@@ -0,0 +1,141 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The request wire format. A request is a frame: a fixed header followed
+   by a sequence of typed fields. All integers are in host byte order (the
+   client and server always run on the same machine).
+
+   header:  4 bytes  magic, "\0SUQ"
+            2 bytes  version
+            2 bytes  flags (PROTO_FLAG_*)
+            4 bytes  length of the fields that follow
+   field:   2 bytes  type
+            2 bytes  reserved (0)
+            4 bytes  length of the value
+            length bytes of value
+
+   String values (all of the types below) include their terminating nul,
+   so the server can use them where they are in its read buffer. Fields
+   of unknown types are skipped.
+
+   Normally, the server replies with a nul-terminated string and closes
+   the connection. A request with PROTO_FLAG_SESSION starts a session
+   instead: the connection stays open for more requests, which are
+   handled in order, and every reply is a frame with the reply text and
+   the request's tag. A reply with PROTO_FLAG_PARTIAL is followed by
+   another one for the same request (as 'wait' does).
+
+   Over a Unix socket, a client can also pass open file descriptors with
+   the frame: they are sent as SCM_RIGHTS with the first byte of the 
+   frame, and the frame has a WD_FD or OUT_FD field (with an empty value)
+   for each of them, in the same order. If they didn't arrive (because the
+   server ran out of descriptors, for example), the server uses the paths
+   instead.
+
+   The magic starts with a nul, which tells frames apart from the older
+   format: a working directory, the arguments and the environment as nul
+   terminated strings, ending with three nuls. The server still accepts
+   that. */
+
+#define PROTO_MAGIC "\0SUQ"
+#define PROTO_MAGIC_SIZE 4
+#define PROTO_VERSION 1
+
+#define PROTO_HEADER_SIZE 12
+#define PROTO_FIELD_HEADER_SIZE 8
+
+/* the largest frame we accept */
+#define PROTO_MAX_LENGTH (64*1024*1024)
+
+/* header flags */
+#define PROTO_FLAG_SESSION 1 /* request: keep the connection for more */
+#define PROTO_FLAG_PARTIAL 2 /* reply: more replies to the request follow */
+#define PROTO_FLAG_ERROR 4 /* reply: the request failed */
+
+/* field types */
+#define PROTO_FIELD_WD 1 /* the client's working directory */
+#define PROTO_FIELD_ARG 2 /* a command line argument */
+#define PROTO_FIELD_ENV 3 /* an environment variable, as name=value */
+#define PROTO_FIELD_OPT 4 /* a request option, as name=value */
+#define PROTO_FIELD_TAG 5 /* the client's name for a request, echoed in the
+                             replies to it */
+#define PROTO_FIELD_TEXT 6 /* reply text */
+#define PROTO_FIELD_WD_FD 7 /* a passed descriptor of the working directory */
+#define PROTO_FIELD_OUT_FD 8 /* a passed descriptor for a job's output */
+
+/* the most descriptors passed with one frame */
+#define PROTO_MAX_FDS 2
+
+/* a frame under construction */
+typedef struct proto_frame
+{
+    char *buf; /* the frame, including the header */
+    size_t len; /* its current length */
+    size_t alloc; /* the allocated size of buf */
+} proto_frame;
+
+/* start a new frame with header flags */
+void proto_frame_init(proto_frame *pf, int flags);
+/* free a frame's buffer */
+void proto_frame_destroy(proto_frame *pf);
+/* add a field with a nul-terminated string value */
+void proto_frame_add_string(proto_frame *pf, int type, const char *str);
+/* finish the frame by filling in its length; pf->buf and pf->len are then 
+   ready to be sent. */
+void proto_frame_finish(proto_frame *pf);
+
+/* write a frame header with flags, for length bytes of fields, to buf */
+void proto_put_header(char *buf, int flags, size_t length);
+/* write a field header for a value of length len to buf */
+void proto_put_field_header(char *buf, int type, size_t len);
+/* get the flags from a frame header */
+int proto_frame_flags(const char *buf);
+
+/* check the start of a frame in buf, of which len bytes are available. 
+   Sets frame_len to the full length of the frame once its header is 
+   available, and to 0 before that. Returns 0 if the frame is acceptable 
+   so far, and -1 if it isn't a frame we can handle. */
+int proto_frame_check(const char *buf, size_t len, size_t *frame_len);
+
+/* get the next field of the complete frame buf of length frame_len. pos 
+   is the read position, and must start at 0. Sets type, value and len.
+   Returns 1 if there was a field, 0 at the end of the frame, and -1 
+   if the frame is malformed. */
+int proto_frame_next_field(const char *buf, size_t frame_len, size_t *pos,
+                           int *type, const char **value, size_t *len);
+
+#endif
+
@@ -44,6 +44,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "job.h"
 #include "settings.h"
 #include "server.h"
+#include "protocol.h"
 #include "request.h"
 #include "usage.h"
 
@@ -54,12 +55,19 @@ void request_process(connection *c, suq_serv *cs)
 {
     request r;
 
-    request_init(&r, c);
-
     /* we assume a complete request */
     c->keep_alive=0;
+    cs->stats.requests++;
 
-    if (r.argc<2)
+    if (request_init(&r, c) < 0)
+    {
+        request_reply_printf(&r, "ERROR: malformed request\n");
+    }
+    else if (c->session && r.argc<2)
+    {
+        /* a request to open the session, or a keep-alive */
+    }
+    else if (r.argc<2)
     {
         request_reply_errstring(&r, "no command");
     }
@@ -86,11 +94,27 @@ void request_process(connection *c, suq_serv *cs)
         {
             request_wait(&r, cs);
         }
+        else if (strcmp(r.argv[1], "watch")==0)
+        {
+            request_watch(&r, cs);
+        }
+        else if (strcmp(r.argv[1], "start")==0)
+        {
+            request_start(&r, cs);
+        }
+        else if (strcmp(r.argv[1], "stats")==0)
+        {
+            request_stats(&r, cs);
+        }
         else if ((strcmp(r.argv[1], "ls")==0) || 
                  (strcmp(r.argv[1], "list")==0))
         {
             request_list(&r, cs);
         }
+        else if (strcmp(r.argv[1], "top")==0)
+        {
+            request_top(&r, cs);
+        }
         else if ( (strcmp(r.argv[1], "ntask")==0)||
                   (strcmp(r.argv[1], "nproc")==0) )
         {
@@ -118,93 +142,234 @@ void request_process(connection *c, suq_serv *cs)
 
 
 
-    if (r.reply_size > 0)
+    /* in a session, the connection stays, and every request gets a 
+       reply, so the client knows it's done */
+    if (c->session)
+        c->keep_alive=1;
+    /* a client that's done once it has the reply may look at the snapshot
+       next, so that must include what this request changed. In a 
+       session, it's published at the end of the round, which saves
+       rebuilding it for each request. */
+    if (!c->session)
+        snapshot_update(&(cs->snap), cs);
+    /* a reply that confirms a change goes out once the journal has it on
+       disk: at the end of this round of the event loop, the journal is
+       synced, and in the next one, the reply is sent */
+    c->defer_write=journal_pending(&(cs->jn));
+    if (r.reply_size > 0 || c->session)
     {
         if (debug>0)
             printf("SERVER: Replying: '%s'\n", r.reply);
-        if (write(c->write_fd, r.reply, r.reply_size+1) < 0)
-            server_system_error("write to client failed");
+        r.reply[r.reply_size]=0;
+        if (connection_write_reply(c, r.tag, 
+                                   r.reply_partial ? PROTO_FLAG_PARTIAL : 0,
+                                   r.reply, r.reply_size) < 0)
+            server_error("write to client failed");
     }
     else
     {
         printf("SERVER: No reply:\n");
     }
+    c->defer_write=0;
     request_destroy(&r);
 }
 
-void request_init(request *r, connection *c)
-{
 #define SPLIT_ALLOC 128
-    size_t nalloc=0;
+
+/* add a string to a NULL-terminated list of n strings */
+static void request_list_add(char ***list, int *n, int *nalloc, char *str)
+{
+    if ( ((*n)+1) >= *nalloc)
+    {
+        *nalloc += SPLIT_ALLOC;
+        *list=realloc_check_server(*list, sizeof(char*)*((*nalloc)+1));
+    }
+    (*list)[(*n)++]=str;
+    (*list)[*n]=NULL;
+}
+
+/* split a frame into its fields. The strings stay in the read buffer. */
+static int request_init_frame(request *r)
+{
+    int argalloc=0, envalloc=0, optalloc=0;
+    size_t pos=0;
+    int type;
+    const char *value;
+    size_t len;
+    int ret;
+    int fd_types[PROTO_MAX_FDS]; /* the fields of the passed fds */
+    int fds[PROTO_MAX_FDS];
+    int nfds=0;
+    int bad=0;
+    int i;
+
+    while( (ret=proto_frame_next_field(r->buf, r->buflen, &pos, &type, 
+                                       &value, &len)) > 0)
+    {
+        /* all the fields we know are strings, nul included */
+        if (len == 0 || value[len-1] != 0)
+        {
+            if (type==PROTO_FIELD_WD || type==PROTO_FIELD_ARG ||
+                type==PROTO_FIELD_ENV || type==PROTO_FIELD_OPT)
+                bad=1;
+            continue;
+        }
+        switch(type)
+        {
+            case PROTO_FIELD_WD:
+                r->wd=(char*)value;
+                break;
+            case PROTO_FIELD_ARG:
+                request_list_add(&(r->argv), &(r->argc), &argalloc, 
+                                 (char*)value);
+                break;
+            case PROTO_FIELD_ENV:
+                request_list_add(&(r->envp), &(r->envc), &envalloc, 
+                                 (char*)value);
+                break;
+            case PROTO_FIELD_TAG:
+                r->tag=(char*)value;
+                break;
+            case PROTO_FIELD_OPT:
+                request_list_add(&(r->optv), &(r->optc), &optalloc, 
+                                 (char*)value);
+                break;
+            case PROTO_FIELD_WD_FD:
+            case PROTO_FIELD_OUT_FD:
+                if (nfds == PROTO_MAX_FDS)
+                    bad=1;
+                else
+                    fd_types[nfds++]=type;
+                break;
+            default:
+                /* from a newer client; we don't need it */
+                break;
+        }
+    }
+    /* the fds are the connection's until we take them, even if the 
+       request is malformed */
+    if (connection_take_fds(r->conn, fds, nfds) == 0)
+    {
+        for(i=0;i<nfds;i++)
+        {
+            int *dest=(fd_types[i]==PROTO_FIELD_WD_FD) ? &(r->wd_fd) : 
+                                                         &(r->out_fd);
+            if (*dest >= 0)
+                close(*dest);
+            *dest=fds[i];
+        }
+    }
+    else if (debug>0 && nfds>0)
+    {
+        printf("SERVER: passed fds were lost; using paths\n");
+    }
+    if (bad || ret < 0 || !r->wd)
+        return -1;
+    if (proto_frame_flags(r->buf) & PROTO_FLAG_SESSION)
+        r->conn->session=1;
+    return 0;
+}
+
+/* split a request in the old format: the wd, the arguments and the
+   environment, all nul-terminated, with an extra nul after each group */
+static int request_init_legacy(request *r)
+{
+    int nalloc;
     size_t j; /* the read cursor */
 
-    /* first split the request */
-    r->buf=c->read_buf;
-    r->buflen=c->read_buf_request;
     r->wd=r->buf; /* the zeroth string is the wd. */
 
     nalloc=0;
-    r->argv=NULL;
-    r->argc=0;
-
     j=strlen(r->wd)+2;
     /* now do the argvs until we hit a double nul */
-    while(! (c->read_buf[j-1]==0 && c->read_buf[j]==0))
+    while(! (r->buf[j-1]==0 && r->buf[j]==0))
     {
-        if (c->read_buf[j-1]==0 && c->read_buf[j]!=0) /* if the previous one 
-                                                         was a nul */
+        if (r->buf[j-1]==0 && r->buf[j]!=0) /* if the previous one 
+                                               was a nul */
         {
-            if ( ((r->argc)+1) >= nalloc)
-            {
-                nalloc += SPLIT_ALLOC;
-                r->argv=realloc_check_server(r->argv, sizeof(char*)*(nalloc+1));
-            }
-            r->argv[(r->argc)++]=c->read_buf + j;
+            request_list_add(&(r->argv), &(r->argc), &nalloc, r->buf + j);
         }
         j++;
     }
-    r->argv[r->argc]=NULL;
 
     /* and now do the envp */
     nalloc=0;
-    r->envp=NULL;
-    r->envc=0;
     j++;
-    while(! (c->read_buf[j-1]==0 && c->read_buf[j]==0))
+    while(! (r->buf[j-1]==0 && r->buf[j]==0))
     {
-        if (c->read_buf[j-1]==0 && c->read_buf[j]!=0) /* if the previous one 
-                                                         was a nul */
+        if (r->buf[j-1]==0 && r->buf[j]!=0) /* if the previous one 
+                                               was a nul */
         {
-            if ( ((r->envc)+1) >= nalloc)
-            {
-                nalloc += SPLIT_ALLOC;
-                r->envp=realloc_check_server(r->envp, sizeof(char*)*(nalloc+1));
-            }
-            r->envp[(r->envc)++]=c->read_buf + j;
+            request_list_add(&(r->envp), &(r->envc), &nalloc, r->buf + j);
         }
         j++;
     }
-    r->envp[r->envc]=NULL;
+    return 0;
+}
+
+int request_init(request *r, connection *c)
+{
+    static char *empty_list[]={ NULL };
+    int ret;
+    int j;
+
+    r->buf=c->read_buf + c->read_buf_start;
+    r->buflen=c->read_buf_request;
+    r->wd=NULL;
+    r->argv=NULL;
+    r->argc=0;
+    r->envp=NULL;
+    r->envc=0;
+    r->optv=NULL;
+    r->optc=0;
+    r->tag=NULL;
+    r->wd_fd=-1;
+    r->out_fd=-1;
+
+    /* allocate the reply */
+    r->reply_alloc=REPLY_SIZE;
+    r->reply_size=0;
+    r->reply_partial=0;
+    r->reply=malloc_check_server(r->reply_alloc*sizeof(char));
+    r->conn=c;
 
-    if (debug>1)
+    if (c->read_buf_framed)
+        ret=request_init_frame(r);
+    else
+        ret=request_init_legacy(r);
+
+    /* the lists are never NULL, even if empty */
+    if (!r->argv)
+        r->argv=empty_list;
+    if (!r->envp)
+        r->envp=empty_list;
+    if (!r->optv)
+        r->optv=empty_list;
+
+    if (ret==0 && debug>1)
     {
         printf("SERVER: request size: %d, %d, wd=%s:", r->argc, r->envc, r->wd);
         for(j=0;j<r->argc;j++)
             printf(" '%s'", r->argv[j]);
         printf("\n");
     }
-    /* then allocate the reply */
-    r->reply_alloc=REPLY_SIZE;
-    r->reply_size=0;
-    r->reply=malloc_check_server(r->reply_alloc*sizeof(char));
-    r->conn=c;
+    return ret;
 }
 
 
 void request_destroy(request *r)
 {
-    free(r->argv);
-    free(r->envp);
+    if (r->argc > 0)
+        free(r->argv);
+    if (r->envc > 0)
+        free(r->envp);
+    if (r->optc > 0)
+        free(r->optv);
+    /* the fds that weren't taken over by a job */
+    if (r->wd_fd >= 0)
+        close(r->wd_fd);
+    if (r->out_fd >= 0)
+        close(r->out_fd);
     /* deallocate the reply */
     free(r->reply);
 }
@@ -222,27 +387,53 @@ void request_reply_errstring(request *r, const char *message)
                           usage_string);
 }
 
+const char *request_get_opt(request *r, const char *name)
+{
+    size_t len=strlen(name);
+    int i;
+
+    for(i=0; i<r->optc; i++)
+    {
+        if (strncmp(r->optv[i], name, len)==0 && r->optv[i][len]=='=')
+            return r->optv[i]+len+1;
+    }
+    return NULL;
+}
+
 void request_reply_printf(request *r, const char *fmt, ...)
 {
-    int nsize=0;
+    va_list ap;
+
+    va_start(ap, fmt);
+    request_reply_vprintf(r, fmt, ap);
+    va_end(ap);
+}
+
+void request_reply_vprintf(request *r, const char *fmt, va_list ap)
+{
+    size_t nsize=0;
     size_t nleft;
     do
     {
-        va_list ap;
-
-        nleft=r->reply_alloc - r->reply_size;
+        va_list aq;
+        int ret;
 
         if (nsize + r->reply_size >= r->reply_alloc)
         {
-            r->reply_alloc += REPLY_SIZE;
+            r->reply_alloc += REPLY_SIZE + nsize;
             r->reply=realloc_check_server(r->reply, 
                                           r->reply_alloc*sizeof(char));
         }
+        nleft=r->reply_alloc - r->reply_size;
 
-        va_start(ap, fmt);
-        nsize=vsnprintf(r->reply + r->reply_size, nleft, fmt, ap);
-        va_end(ap);
-    } while (nsize  > nleft);
+        va_copy(aq, ap);
+        ret=vsnprintf(r->reply + r->reply_size, nleft, fmt, aq);
+        va_end(aq);
+        /* an output error: the reply stays as it was */
+        if (ret < 0)
+            return;
+        nsize=ret;
+    } while (nsize >= nleft);
     r->reply_size += nsize;
 }
 
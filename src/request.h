@@ -32,6 +32,8 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __REQUEST_H__
 #define __REQUEST_H__
 
+#include <stdarg.h>
+
 #define REPLY_SIZE 10*1024
 
 
@@ -47,6 +49,11 @@ typedef struct request
     char **argv; /* the client arguments */
     int envc; /* the number of client environment variables */
     char **envp; /* the client environment variables */
+    int optc; /* the number of request options */
+    char **optv; /* the request options, as name=value */
+    char *tag; /* the client's tag for the request in a session, or NULL */
+    int wd_fd; /* the working directory as passed by the client, or -1 */
+    int out_fd; /* the job output file as passed by the client, or -1 */
 
     char *buf; /* buffer to the raw request, into which wd, argv, and 
                   environ point. */
@@ -55,19 +62,25 @@ typedef struct request
     char *reply; /* the request reply */
     size_t reply_alloc; /* number of allocated bytes to reply */
     size_t reply_size;
+    int reply_partial; /* whether another reply will follow this one */
 
     connection *conn; /* the associated connection */
 } request;
 
-/* create a request from connection data */
-void request_init(request *r, connection *c);
+/* create a request from connection data. Returns 0 on success, and -1 if 
+   the request is malformed. */
+int request_init(request *r, connection *c);
 /* deallocate everything connected to a request */
 void request_destroy(request *r);
 
 /* replace the reply string with an error message, and a usage string */
 void request_reply_errstring(request *r, const char *message);
+/* get the value of request option name, or NULL if it wasn't given */
+const char *request_get_opt(request *r, const char *name);
 /* print fmt, etc. to the reply */
 void request_reply_printf(request *r, const char *fmt, ...);
+/* the same, with a va_list */
+void request_reply_vprintf(request *r, const char *fmt, va_list ap);
 
 
 /* process a run request */
@@ -84,7 +97,15 @@ void request_info(request *r, suq_serv *cs);
 void request_nproc(request *r, suq_serv *cs);
 /* process a ntask request */
 void request_ntask(request *r, suq_serv *cs);
+/* process a top request */
+void request_top(request *r, suq_serv *cs);
 /* process a wait request */
 void request_wait(request *r, suq_serv *cs);
+/* process a watch request */
+void request_watch(request *r, suq_serv *cs);
+/* process a start request */
+void request_start(request *r, suq_serv *cs);
+/* process a stats request */
+void request_stats(request *r, suq_serv *cs);
 
 #endif
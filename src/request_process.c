@@ -38,6 +38,10 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <unistd.h>
 #include <string.h>
 #include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <ctype.h>
+#include <sys/param.h>
 
 #include "err.h"
 #include "connection.h"
@@ -61,6 +65,80 @@ static char *request_get_arg(request *r, int arg_ind)
 }
 
 
+/* the longest time we take, in seconds. A job keeps it in an int, and 
+   timer_add() takes it in milliseconds as an unsigned long, to which the
+   monotonic clock is added: we keep it to half of that range. That is
+   only the tighter limit (about 24 days) where a long has 32 bits. */
+#if ULONG_MAX/2000 < INT_MAX
+#define REQUEST_TIME_MAX ((long)(ULONG_MAX/2000))
+#else
+#define REQUEST_TIME_MAX ((long)INT_MAX)
+#endif
+
+/* parse a time in the form [[hh:]mm:]ss. Returns the number of seconds,
+   or -1 if it's not a valid time. */
+static int request_parse_time(const char *str)
+{
+    long ret=0;
+    int nfields=0;
+    const char *p=str;
+
+    do
+    {
+        char *end;
+        long val;
+
+        /* strtol() would also take signs and leading spaces */
+        if (!isdigit((unsigned char)*p))
+            return -1;
+        errno=0;
+        val=strtol(p, &end, 10);
+        if (errno != 0 || val > REQUEST_TIME_MAX || 
+            ret > (REQUEST_TIME_MAX - val)/60)
+            return -1;
+        ret = ret*60 + val;
+        nfields++;
+        p=end;
+        if (*p == ':')
+        {
+            p++;
+            if (*p == 0)
+                return -1; /* an empty field at the end */
+        }
+        else if (*p != 0)
+            return -1;
+    } while(*p);
+    if (nfields > 3)
+        return -1;
+    return (int)ret;
+}
+
+/* parse a size in bytes, with an optional k, M or G suffix (powers of 
+   1024). Returns -1 if it isn't a size. */
+static long long request_parse_size(const char *str)
+{
+    char *end;
+    long long val=strtoll(str, &end, 10);
+
+    if (end==str || val<0)
+        return -1;
+    switch(*end)
+    {
+        case 'k': case 'K':
+            val *= 1024LL; end++; break;
+        case 'm': case 'M':
+            val *= 1024LL*1024LL; end++; break;
+        case 'g': case 'G':
+            val *= 1024LL*1024LL*1024LL; end++; break;
+        default:
+            break;
+    }
+    if (*end != 0)
+        return -1;
+    return val;
+}
+
+
 #if 0
 #define request_get_arg(r, i, a) {\
     int ii=i; /* to avoid double evaluation */ \
@@ -80,9 +158,18 @@ void request_run(request *r, suq_serv *cs)
     int arg_ind;
     int cont=1;
     char *wd=r->wd;
+    char *out=NULL;
     job *j=malloc_check_server(sizeof(job));
     char *arg;
 
+    /* it wouldn't be journaled, and its server is about to go */
+    if (cs->shutdown)
+    {
+        request_reply_printf(r, "ERROR: the queuer is shutting down\n");
+        free(j);
+        return;
+    }
+
     job_init(j);
 
     j->id=suq_settings_get_next_id(cs->st);
@@ -107,6 +194,12 @@ void request_run(request *r, suq_serv *cs)
             if (!wd) goto err;
             ++arg_ind;
         }
+        else if (strcmp(arg, "-o") == 0)
+        {
+            out=request_get_arg(r, ++arg_ind);
+            if (!out) goto err;
+            ++arg_ind;
+        }
         else if (strcmp(arg, "-n") == 0)
         {
             char *nps;
@@ -146,6 +239,46 @@ void request_run(request *r, suq_serv *cs)
             j->ntask=-1;
             ++arg_ind;
         }
+        else if (strcmp(arg, "-m")==0)
+        {
+            char *ms;
+
+            ms=request_get_arg(r, ++arg_ind);
+            if (!ms) goto err;
+            j->mem_max=request_parse_size(ms);
+            if (j->mem_max<=0)
+            {
+                request_reply_errstring(r, 
+                                "suq run -m is not a size > 0 (like 512M)");
+                goto err;
+            }
+            ++arg_ind;
+        }
+        else if (strcmp(arg, "-s")==0)
+        {
+            j->scavenger=1;
+            ++arg_ind;
+        }
+        else if (strcmp(arg, "-E")==0)
+        {
+            j->no_env=1;
+            ++arg_ind;
+        }
+        else if (strcmp(arg, "-t")==0)
+        {
+            char *ts;
+
+            ts=request_get_arg(r, ++arg_ind);
+            if (!ts) goto err;
+            j->walltime=request_parse_time(ts);
+            if (j->walltime<=0)
+            {
+                request_reply_errstring(r, 
+                                "suq run -t is not a time [[hh:]mm:]ss > 0");
+                goto err;
+            }
+            ++arg_ind;
+        }
         else
             cont=0;
     } while(cont);
@@ -182,10 +315,34 @@ void request_run(request *r, suq_serv *cs)
     /* now construct everything from this data */
     job_reinit(j);
 
+    /* the client may have passed the directory and the output file. If it
+       didn't, we use their names; the output file is relative to the 
+       client's directory, like the client would have opened it. */
+    if (wd == r->wd && r->wd_fd >= 0)
+    {
+        j->wd_fd=r->wd_fd;
+        r->wd_fd=-1;
+    }
+    if (out)
+    {
+        if (out[0] == '/')
+            snprintf(j->stdout_filename, MAXPATHLEN, "%s", out);
+        else
+            snprintf(j->stdout_filename, MAXPATHLEN, "%s/%s", r->wd, out);
+        j->out_fd=r->out_fd;
+        r->out_fd=-1;
+    }
+
     /* then process the job */
     j->state=waiting;
 
     joblist_add(&(cs->jl), j);
+    {
+        char detail[64];
+        snprintf(detail, sizeof(detail), "prio %d ntask %d", j->prio, 
+                 j->ntask);
+        suq_serv_event(cs, j, "submitted", detail);
+    }
     joblist_check_run(&(cs->jl), cs);
 
     /* print result */
@@ -249,12 +406,13 @@ void request_del(request *r, suq_serv *cs)
             /* here we actually remove the job from the list */
             if (! (j->state == running) )
             {
+                suq_serv_event(cs, j, "deleted", NULL);
                 joblist_remove(&(cs->jl), j);
                 request_reply_printf(r, "Removed job id %d\n", id);
             }
             else
             {
-                job_cancel(j);
+                suq_serv_kill_job(cs, j);
                 request_reply_printf(r, "Killed job id %d\n", id);
             }
             found=1;
@@ -314,8 +472,12 @@ void request_pri(request *r, suq_serv *cs)
             int oldpri=j->prio;
             if (oldpri != newpri)
             {
+                char detail[64];
+
                 j->prio=newpri;
                 joblist_re_place(&(cs->jl), j);
+                snprintf(detail, sizeof(detail), "%d %d", oldpri, newpri);
+                suq_serv_event(cs, j, "priority", detail);
                 request_reply_printf(r, 
                                      "Job id %d priority set from %d to %d\n", 
                                      j->id, oldpri, newpri);
@@ -337,12 +499,17 @@ err:
 
 
 
+/* print into the reply, for the snapshot formatters */
+static void request_snap_print(void *ctx, const char *fmt, va_list ap)
+{
+    request_reply_vprintf((request*)ctx, fmt, ap);
+}
+
 void request_info(request *r, suq_serv *cs)
 {
-    job *j;
+    const snapshot *snap;
     int search_id;
     char *arg;
-    int found=0;
 
     arg=request_get_arg(r, 2);
     if (!arg) goto err;
@@ -362,99 +529,59 @@ void request_info(request *r, suq_serv *cs)
         }
     }
   
-    j=joblist_first(&(cs->jl)); 
-    while(j)
-    {
-        job *jnext=joblist_next(&(cs->jl), j);
-        if (search_id == -1 || j->id == search_id)
-        {
-            char timestr[26];
-            char *loc;
-
-            ctime_r(&(j->sub_time), timestr);
-            loc=strchr(timestr, '\n'); /* remove newline */
-            if (loc)
-                *loc=0;
-
-            /* we found one */
-            request_reply_printf(r, "Name:                 %s\n", j->name);
-            request_reply_printf(r, "Job id:               %d\n", j->id);
-            request_reply_printf(r, "Priority:             %d\n", j->prio);
-            request_reply_printf(r, "State:                %s\n", 
-                                 job_state_strings[j->state]);
-            request_reply_printf(r, "Submit time:          %s\n", timestr);
-            if (j->state==running || j->state==started)
-            {
-                ctime_r(&(j->start_time), timestr);
-                loc=strchr(timestr, '\n'); /* remove newline */
-                if (loc)
-                    *loc=0;
-                request_reply_printf(r, "Start time:           %s\n", timestr);
-                request_reply_printf(r, "Process id:           %d\n", j->pid);
-            }
-            if (j->state==run_error || j->state==resource_error)
-            {
-                request_reply_printf(r, "Error string:         %s\n", 
-                                     j->error_string);
-            }
-
-            request_reply_printf(r, "Nr. of tasks:         %d\n", j->ntask);
-            request_reply_printf(r, "Command:              %s\n", j->cmd);
-            request_reply_printf(r, "Nr. of args:          %d\n", j->argc);
-            request_reply_printf(r, "Nr. of env vars:      %d\n", j->envc);
-            request_reply_printf(r, "Working directory:    %s\n", j->wd);
-            request_reply_printf(r, "\n");
-            found=1;
-        }
-        j=jnext;
-    }
-    if (!found)
+    /* the same as the client prints from the snapshot file */
+    snap=snapshot_update(&(cs->snap), cs);
+    if (!snapshot_print_info(snap, search_id, request_snap_print, r))
         request_reply_printf(r, "ERROR: Job not found\n");
     return;
 err:
     return;
 }
 
-
 void request_list(request *r, suq_serv *cs)
+{
+    /* the same as the client prints from the snapshot file */
+    snapshot_print_list(snapshot_update(&(cs->snap), cs), 
+                        request_snap_print, r);
+}
+
+void request_top(request *r, suq_serv *cs)
 {
     job *j;
     int i=0;
-    int n_running=0;
 
+    request_reply_printf(r,"%4s %5s %6s %6s %6s %5s %5s %9s %9s %9s %s\n", 
+                         "ID", "NTASK", "%CPU", "AVG", "MAX", "NPROC", "NTHR", 
+                         "RSS(MB)", "READ/s", "WRITE/s", "NAME");
     j=joblist_first(&(cs->jl)); 
     while(j)
     {
         if (j->state == running)
-            n_running += j->ntask;
-        j=joblist_next(&(cs->jl), j);
-    }
-    request_reply_printf(r,"running tasks: %4d\n", n_running);
-    request_reply_printf(r,"max tasks:     %4d\n", cs->st->ntask);
-
-    /* walk the list, so earlier jobs are printed first */
-    request_reply_printf(r,"%4s %4s %7s %5s %s\n", "ID", "PRIO", "STATE",     
-                         "NTASK", "NAME");
-    j=joblist_first(&(cs->jl)); 
-    while(j)
-    {
-#define TASKSTRLEN 10
-        char taskstr[TASKSTRLEN];
-    
-        if (j->ntask > 0)
-            snprintf(taskstr, TASKSTRLEN, "%5d", j->ntask);
-        else
-            snprintf(taskstr, TASKSTRLEN, "%5s", "block");
+        {
+            job_sample *js=&(j->smp);
 
-        request_reply_printf(r,"%4d %4d %7s %5s '%s'\n", j->id, j->prio,
-                             job_state_strings[j->state], taskstr,
-                             j->name);
-        i++;
+            if (js->nsamples > 1)
+            {
+                request_reply_printf(r,
+                        "%4d %5d %6.0f %6.0f %6.0f %5d %5d %9.1f %9.0f %9.0f "
+                        "'%s'\n", j->id, j->ntask, 100.*js->cpu, 
+                        100.*js->cpu_avg, 100.*js->cpu_max, js->nproc, 
+                        js->nthread, js->rss_kb/1024., js->read_rate, 
+                        js->write_rate, j->name);
+            }
+            else
+            {
+                request_reply_printf(r,"%4d %5d %6s %6s %6s %5s %5s %9s %9s "
+                                     "%9s '%s'\n", j->id, j->ntask, "-", "-", 
+                                     "-", "-", "-", "-", "-", "-", j->name);
+            }
+            i++;
+        }
         j=joblist_next(&(cs->jl), j);
     }
 
     if (i==0)
-        request_reply_printf(r,"   No jobs.\n");
+        request_reply_printf(r,"   No running jobs.\n");
 }
 
 void request_ntask(request *r, suq_serv *cs)
@@ -479,6 +606,7 @@ void request_ntask(request *r, suq_serv *cs)
 
 
         suq_settings_set_ntask(cs->st, ntask);
+        cs->snap.dirty=1;
         res_err=joblist_check_ntask(&(cs->jl), cs);
         request_reply_printf(r,"Maximum number of tasks is set to: %d\n", 
                              cs->st->ntask);
@@ -497,13 +625,16 @@ void request_ntask(request *r, suq_serv *cs)
         j=joblist_first(&(cs->jl)); 
         while(j)
         {
-            if (j->state == running)
-                n_running += j->ntask;
+            if (j->state == running && !j->scavenger)
+                n_running += job_width(j, cs->st->ntask);
             j=joblist_next(&(cs->jl), j);
         }
 
         request_reply_printf(r,"running tasks: %4d\n", n_running);
         request_reply_printf(r,"max tasks:     %4d\n", cs->st->ntask);
+        request_reply_printf(r,"capacity:      %4d cpus, %lld MB memory\n",
+                             cs->cap.ncpu, cs->cap.mem/(1024*1024));
+        request_reply_printf(r,"               (%s)\n", cs->cap.reason);
     }
     return;
 err:
@@ -518,6 +649,7 @@ void request_wait(request *r, suq_serv *cs)
     char *end;
 
     jw=malloc_check_server(sizeof(jobwait));
+    jobwait_init(jw);
     if (r->argc > 2)
     {
         arg=request_get_arg(r, 2);
@@ -547,8 +679,11 @@ void request_wait(request *r, suq_serv *cs)
 
     if (!joblist_wait_check_finished(&(cs->jl), jw) )
     {
+        if (r->tag)
+            jw->tag=strdup(r->tag);
         joblist_wait_add(&(cs->jl), jw);
         jw->conn->keep_alive=1; 
+        r->reply_partial=1;
         request_reply_printf(r, "Waiting...\n");
     }
     else
@@ -563,5 +698,82 @@ err:
     return;
 }
 
+void request_watch(request *r, suq_serv *cs)
+{
+    jobwatch *jw;
+    int i;
+
+    jw=malloc_check_server(sizeof(jobwatch));
+    jobwatch_init(jw);
+
+    for(i=2; i<r->argc; i++)
+    {
+        char *arg=r->argv[i];
+
+        if (strcmp(arg, "-n")==0)
+        {
+            arg=request_get_arg(r, ++i);
+            if (!arg) goto err;
+            jobwatch_add_name(jw, arg);
+        }
+        else
+        {
+            char *end;
+            int id=strtol(arg, &end, 10);
+
+            if (end==arg || *end)
+            {
+                request_reply_errstring(r, 
+                                        "watch id argument is not a number");
+                goto err;
+            }
+            jobwatch_add_id(jw, id);
+        }
+    }
 
+    jw->conn=r->conn;
+    if (r->tag)
+        jw->tag=strdup(r->tag);
+    jobwatch_list_add(&(cs->wl), jw);
+    /* the events follow as they happen */
+    r->conn->keep_alive=1;
+    r->reply_partial=1;
+    return;
+err:
+    jobwatch_destroy(jw);
+    free(jw);
+}
 
+void request_start(request *r, suq_serv *cs)
+{
+    /* the client has started us if we weren't running; once it's gone,
+       we linger as usual */
+    request_reply_printf(r, "Queuer running (pid %d), ", (int)getpid());
+    if (cs->st->linger > 0)
+        request_reply_printf(r, "staying up for %d s when idle.\n", 
+                             cs->st->linger);
+    else
+        request_reply_printf(r, "exiting when idle (linger is 0).\n");
+}
+
+void request_stats(request *r, suq_serv *cs)
+{
+    serv_stats *ss=&(cs->stats);
+
+    request_reply_printf(r, "uptime:               %ld s\n", 
+                         (long)(time(NULL) - ss->start_time));
+    request_reply_printf(r, "requests:             %lu\n", ss->requests);
+    request_reply_printf(r, "connections:          %d open, %lu accepted\n",
+                         conn_list_N(&(cs->cl)), ss->accepted);
+    request_reply_printf(r, "watches:              %d\n", cs->wl.N);
+    request_reply_printf(r, "listen backlog:       %d\n", cs->st->backlog);
+    request_reply_printf(r, "linger:               %d s\n", cs->st->linger);
+    /* what we accept in one go is what was waiting in the accept queue */
+    request_reply_printf(r, "accept queue depth:   %d last, %.1f mean, "
+                         "%d max\n", ss->accept_last,
+                         ss->accept_wakeups ? 
+                         (double)ss->accepted/ss->accept_wakeups : 0.,
+                         ss->accept_max);
+    request_reply_printf(r, "accept errors:        %lu\n", 
+                         ss->accept_errors);
+}
@@ -0,0 +1,294 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/param.h>
+
+#include "err.h"
+#include "sample.h"
+
+
+/* parse the contents of /proc/<pid>/stat. Returns 0 on success. */
+static int sample_parse_stat(char *buf, proc_info *pi)
+{
+    /* the command name may contain anything, so we start after the last
+       closing parenthesis */
+    char *p=strrchr(buf, ')');
+    char state;
+    unsigned long utime, stime;
+    long cutime, cstime, nthread, rss;
+    int ppid, pgrp;
+
+    if (!p)
+        return -1;
+    /* fields 3 and up */
+    if (sscanf(p+2, "%c %d %d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+                    "%ld %ld %*d %*d %ld %*d %*u %*u %ld", 
+               &state, &ppid, &pgrp, &utime, &stime, &cutime, &cstime,
+               &nthread, &rss) != 9)
+    {
+        return -1;
+    }
+    pi->ppid=ppid;
+    pi->pgrp=pgrp;
+    /* we include the waited-for children, so that the total doesn't drop
+       when a process inside the job exits */
+    pi->cpu_ticks=utime+stime+cutime+cstime;
+    pi->nthread=nthread;
+    pi->rss_kb=rss*(sysconf(_SC_PAGESIZE)/1024);
+    return 0;
+}
+
+void sample_procs(sample_proc_func func, void *data)
+{
+    DIR *dir;
+    struct dirent *de;
+
+    dir=opendir("/proc");
+    if (!dir)
+        return;
+    while( (de=readdir(dir)) )
+    {
+        char filename[MAXPATHLEN];
+        char buf[1024];
+        proc_info pi;
+        FILE *in;
+        size_t len;
+        char *end;
+
+        pi.pid=strtol(de->d_name, &end, 10);
+        if (end == de->d_name || *end != 0)
+            continue;
+
+        snprintf(filename, MAXPATHLEN, "/proc/%d/stat", pi.pid);
+        in=fopen(filename, "r");
+        if (!in)
+            continue; /* it has exited in the meantime */
+        len=fread(buf, 1, sizeof(buf)-1, in);
+        fclose(in);
+        buf[len]=0;
+
+        if (sample_parse_stat(buf, &pi) == 0)
+            func(&pi, data);
+    }
+    closedir(dir);
+}
+
+int sample_proc_io(pid_t pid, unsigned long long *read_bytes, 
+                   unsigned long long *write_bytes)
+{
+    char filename[MAXPATHLEN];
+    char name[64];
+    unsigned long long val;
+    FILE *in;
+    int found=0;
+
+    snprintf(filename, MAXPATHLEN, "/proc/%d/io", pid);
+    in=fopen(filename, "r");
+    if (!in)
+        return -1;
+    while(fscanf(in, "%63s %llu", name, &val) == 2)
+    {
+        if (strcmp(name, "read_bytes:") == 0)
+        {
+            *read_bytes=val;
+            found++;
+        }
+        else if (strcmp(name, "write_bytes:") == 0)
+        {
+            *write_bytes=val;
+            found++;
+        }
+    }
+    fclose(in);
+    return (found == 2) ? 0 : -1;
+}
+
+
+
+void cpu_stat_init(cpu_stat *cs)
+{
+    cs->valid=0;
+    cs->ncpu=0;
+    cs->idle=NULL;
+    cs->total=NULL;
+}
+
+void cpu_stat_destroy(cpu_stat *cs)
+{
+    free(cs->idle);
+    free(cs->total);
+    cpu_stat_init(cs);
+}
+
+double sample_cpu_idle(cpu_stat *cs, const int *cpus, int ncpu)
+{
+    FILE *in;
+    char line[512];
+    double ret=0;
+    int k=0;
+
+    if (cs->ncpu != ncpu)
+    {
+        cs->idle=realloc_check_server(cs->idle, 
+                                      sizeof(unsigned long long)*ncpu);
+        cs->total=realloc_check_server(cs->total, 
+                                       sizeof(unsigned long long)*ncpu);
+        memset(cs->idle, 0, sizeof(unsigned long long)*ncpu);
+        memset(cs->total, 0, sizeof(unsigned long long)*ncpu);
+        cs->ncpu=ncpu;
+        cs->valid=0;
+    }
+
+    in=fopen("/proc/stat", "r");
+    if (!in)
+        return -1;
+    /* the aggregate 'cpu' line counts cpus we may not use, so we add up
+       the 'cpuN' lines of ours. They come in increasing order; a cpu 
+       that is offline has no line, and isn't idle for us. */
+    while(k<ncpu && fgets(line, sizeof(line), in))
+    {
+        unsigned long long v[8];
+        unsigned long long idle, total;
+        int n, i;
+
+        /* user nice system idle iowait irq softirq steal */
+        if (strncmp(line, "cpu", 3) != 0 || !isdigit((unsigned char)line[3]))
+            continue;
+        if (sscanf(line, "cpu%d %llu %llu %llu %llu %llu %llu %llu %llu", 
+                   &n, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], 
+                   &v[7]) != 9)
+            continue;
+        while(k<ncpu && cpus[k] < n)
+            k++;
+        if (k>=ncpu || cpus[k] != n)
+            continue;
+
+        idle=v[3]+v[4];
+        total=0;
+        for(i=0;i<8;i++)
+            total+=v[i];
+        if (cs->valid && total > cs->total[k])
+            ret += (double)(idle - cs->idle[k])/(double)(total-cs->total[k]);
+        cs->idle[k]=idle;
+        cs->total[k]=total;
+        k++;
+    }
+    fclose(in);
+
+    if (!cs->valid)
+    {
+        cs->valid=1;
+        return -1;
+    }
+    return ret;
+}
+
+void job_sample_init(job_sample *js)
+{
+    memset(js, 0, sizeof(job_sample));
+}
+
+void job_sample_begin(job_sample *js)
+{
+    js->cur_cpu_ticks=0;
+    js->cur_read_bytes=js->cur_write_bytes=0;
+    js->cur_rss_kb=0;
+    js->cur_nproc=js->cur_nthread=0;
+}
+
+void job_sample_add(job_sample *js, proc_info *pi, 
+                    unsigned long long read_bytes, 
+                    unsigned long long write_bytes)
+{
+    js->cur_cpu_ticks += pi->cpu_ticks;
+    js->cur_read_bytes += read_bytes;
+    js->cur_write_bytes += write_bytes;
+    js->cur_rss_kb += pi->rss_kb;
+    js->cur_nproc++;
+    js->cur_nthread += pi->nthread;
+}
+
+/* the difference between two counters, which may go down when a process
+   exits and takes its counts with it */
+static double sample_delta(unsigned long long cur, unsigned long long prev)
+{
+    return (cur > prev) ? (double)(cur - prev) : 0.;
+}
+
+void job_sample_end(job_sample *js)
+{
+    struct timeval now, dt;
+    double dts;
+
+    gettimeofday(&now, NULL);
+    timersub(&now, &(js->time), &dt);
+    dts=dt.tv_sec + dt.tv_usec*1e-6;
+
+    if (js->nsamples > 0 && dts > 0)
+    {
+        js->cpu=sample_delta(js->cur_cpu_ticks, js->cpu_ticks)/
+                (sysconf(_SC_CLK_TCK)*dts);
+        js->read_rate=sample_delta(js->cur_read_bytes, js->read_bytes)/dts;
+        js->write_rate=sample_delta(js->cur_write_bytes, js->write_bytes)/dts;
+
+        if (js->nsamples == 1)
+            js->cpu_avg=js->cpu;
+        else
+            js->cpu_avg=SAMPLE_AVG_WEIGHT*js->cpu + 
+                        (1.-SAMPLE_AVG_WEIGHT)*js->cpu_avg;
+        if (js->cpu > js->cpu_max)
+            js->cpu_max=js->cpu;
+    }
+
+    js->cpu_ticks=js->cur_cpu_ticks;
+    js->read_bytes=js->cur_read_bytes;
+    js->write_bytes=js->cur_write_bytes;
+    js->rss_kb=js->cur_rss_kb;
+    if (js->rss_kb > js->rss_max_kb)
+        js->rss_max_kb=js->rss_kb;
+    js->nproc=js->cur_nproc;
+    js->nthread=js->cur_nthread;
+    if (js->nthread > js->nthread_max)
+        js->nthread_max=js->nthread;
+
+    js->time=now;
+    js->nsamples++;
+}
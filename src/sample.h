@@ -0,0 +1,124 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __SAMPLE_H__
+#define __SAMPLE_H__
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+/* the weight of the newest sample in the rolling average */
+#define SAMPLE_AVG_WEIGHT 0.2
+
+/* the information read from /proc about a single process */
+typedef struct proc_info
+{
+    pid_t pid;
+    pid_t ppid;
+    pid_t pgrp; /* the process group */
+    unsigned long long cpu_ticks; /* utime+stime (including waited-for
+                                     children) in clock ticks */
+    int nthread; /* the number of threads */
+    long rss_kb; /* the resident set size */
+} proc_info;
+
+/* live resource usage of a running job, with rolling statistics. */
+typedef struct job_sample
+{
+    int nsamples; /* the number of samples taken */
+    struct timeval time; /* the time of the last sample */
+
+    double cpu; /* cpu usage in cores over the last interval */
+    double cpu_avg; /* rolling average of cpu */
+    double cpu_max; /* the maximum of cpu */
+    long rss_kb; /* resident set size of all processes */
+    long rss_max_kb; /* the maximum of rss_kb */
+    double read_rate; /* bytes read per second over the last interval */
+    double write_rate; /* bytes written per second over the last interval */
+    int nproc; /* the number of processes */
+    int nthread; /* the number of threads */
+    int nthread_max; /* the maximum of nthread */
+
+    /* the totals of the last sample */
+    unsigned long long cpu_ticks; 
+    unsigned long long read_bytes, write_bytes;
+
+    /* the totals of the sample being taken */
+    unsigned long long cur_cpu_ticks;
+    unsigned long long cur_read_bytes, cur_write_bytes;
+    long cur_rss_kb;
+    int cur_nproc, cur_nthread;
+} job_sample;
+
+/* the cpu time counters from /proc/stat of the cpus we may use */
+typedef struct cpu_stat
+{
+    int valid; /* whether the counters have been read */
+    int ncpu; /* the number of cpus in the arrays */
+    unsigned long long *idle; /* idle and iowait ticks of each cpu */
+    unsigned long long *total; /* all ticks of each cpu */
+} cpu_stat;
+
+/* the function that gets called for every process */
+typedef void (*sample_proc_func)(proc_info *pi, void *data);
+
+/* read /proc/<pid>/stat for all processes, and call func for each */
+void sample_procs(sample_proc_func func, void *data);
+
+/* read the I/O byte counts of a process. Returns 0 on success. */
+int sample_proc_io(pid_t pid, unsigned long long *read_bytes, 
+                   unsigned long long *write_bytes);
+
+/* initialize the cpu counters */
+void cpu_stat_init(cpu_stat *cs);
+
+/* deallocate the cpu counters */
+void cpu_stat_destroy(cpu_stat *cs);
+
+/* read /proc/stat, and return how many of the ncpu cpus (with the 
+   increasing numbers in cpus) were idle since the last call: the sum of 
+   their idle fractions. Returns -1 if that isn't known (yet). */
+double sample_cpu_idle(cpu_stat *cs, const int *cpus, int ncpu);
+
+/* initialize a job sample */
+void job_sample_init(job_sample *js);
+
+/* start taking a new sample */
+void job_sample_begin(job_sample *js);
+
+/* add a process (and its I/O counts) to the sample being taken */
+void job_sample_add(job_sample *js, proc_info *pi, 
+                    unsigned long long read_bytes, 
+                    unsigned long long write_bytes);
+
+/* finish the sample and update the statistics */
+void job_sample_end(job_sample *js);
+
+#endif /* __SAMPLE_H__ */
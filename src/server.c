@@ -37,16 +37,21 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 #include <sys/wait.h>
+#include <sys/file.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 #include <errno.h>
 #include <signal.h>
 
@@ -58,150 +63,291 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "connection.h"
 #include "job.h"
 #include "sig_handler.h"
-
-#define NSIGREAD 16
+#include "timer.h"
 
 /* explicitly a global variable to allow signal handler access */
 suq_serv cs;
 
 
-#define fscount(n, fs)  n = ( (fs) > (n) ? (fs)  : (n) )
+/* the interval at which we re-check jobs whose main process has exited,
+   but whose other processes haven't */
+#define TREE_CHECK_MS 1000
 
-void suq_serv_main(suq_settings *st, int pipe_in, int pipe_out)
+/* the event function for the signal fd */
+static void suq_serv_signal_event(event_source *es, int events, void *data)
 {
-    sig_handler sh;
+    sig_handler *sh=(sig_handler*)data;
+    int sig;
 
-    suq_serv_init(&cs, st, pipe_in, pipe_out);
-    sig_handler_init(&sh);
+    while ( (sig=sig_handler_read(sh)) > 0)
+    {
+        suq_serv_handle_signal(&cs, sig);
+    }
+}
 
-    /* now check for incoming data. */
-    do
+/* the event function for the listening socket */
+static void suq_serv_sock_event(event_source *es, int events, void *data)
+{
+    suq_serv_accept_connection((suq_serv*)data);
+}
+
+/* drop the waits and watches of a connection that goes away */
+static int suq_serv_drop_conn(suq_serv *cs, connection *cn)
+{
+    jobwait *jw;
+    int n=0;
+
+    /* a session can have several waits */
+    while( (jw=joblist_wait_search_conn(&(cs->jl), cn)) )
     {
-        fd_set rfs; /* the select file descriptor set */
-        int retval; /* select() return value */
-        int n=0; /* the highest-value fd */
-        connection *cn;
-        int shf=sig_handler_get_reader(&sh);
+        joblist_wait_remove(&(cs->jl), jw);
+        n++;
+    }
+    n += jobwatch_list_remove_conn(&(cs->wl), cn);
+    return n;
+}
 
-        FD_ZERO(&rfs);
+/* remove the connections that are closed or failed */
+static void suq_serv_remove_closed(suq_serv *cs)
+{
+    connection *cn=conn_list_first(&(cs->cl));
 
-        FD_SET(cs.sockdes, &rfs);
-        fscount(n, cs.sockdes);
-        if (debug>1)
-            printf("SERVER: Adding select fd %d from socket\n", cs.sockdes);
+    while(cn)
+    {
+        if (cn->dead || !cn->write_open)
+            suq_serv_drop_conn(cs, cn);
+        cn=conn_list_next(&(cs->cl), cn);
+    }
+    conn_list_remove_closed(&(cs->cl));
+}
+
+/* the event function for connections */
+static void suq_serv_conn_event(event_source *es, int events, void *data)
+{
+    connection *cn=(connection*)data;
+    int eof=0;
+
+    if (connection_pending(cn))
+    {
+        /* queued replies go out first; the read side waits */
+        int res=connection_flush(cn);
+
+        if (res > 0)
+            return;
+        if (res < 0 || cn->close_after_flush)
+            eof=1;
+    }
+    /* this also picks up requests of a session that came in while we were
+       sending replies */
+    if (!eof && !cn->dead && connection_read(cn, &cs)==0)
+    {
+        cn->read_open=0;
+        eof=1;
+    }
 
-        FD_SET(shf, &rfs);
-        fscount(n, shf);
+    if (eof || cn->dead)
+    {
+        suq_serv_drop_conn(&cs, cn);
+        conn_list_remove_flushed(&(cs.cl), cn);
+    }
+    else if (!cn->keep_alive)
+    {
+        conn_list_remove_flushed(&(cs.cl), cn);
+    }
+}
+
+void suq_serv_pidfd_event(event_source *es, int events, void *data)
+{
+    job *j=(job*)data;
+
+    if (debug>1)
+        printf("SERVER: pidfd %d of job %d ready\n", j->pidfd, j->id);
+    suq_serv_reap_job(&cs, j);
+}
+
+static void suq_serv_retire(suq_serv *cs);
+
+/* whether the server loop should go on. Without connections or jobs, we 
+   stay around for the linger time first, so that the next client doesn't 
+   have to start a new server. */
+static int suq_serv_keep_running(suq_serv *cs)
+{
+    if ( (conn_list_N(&(cs->cl))>0) || (joblist_N(&(cs->jl))>0) )
+    {
+        timer_del(&(cs->linger_timer));
+        cs->lingered=0;
+        return 1;
+    }
+    if (cs->sockdes < 0)
+        return 0;
+    if (cs->shutdown || cs->lingered || cs->st->linger <= 0)
+    {
+        suq_serv_retire(cs);
+        return (conn_list_N(&(cs->cl))>0);
+    }
+    if (!timer_active(&(cs->linger_timer)))
+    {
         if (debug>1)
-            printf("SERVER: Adding select fd %d from pipe\n", shf);
+            printf("SERVER: idle; lingering for %d s\n", cs->st->linger);
+        timer_add(&(cs->tw), &(cs->linger_timer), cs->st->linger*1000UL);
+    }
+    return 1;
+}
 
-        conn_list_remove_closed(&(cs.cl));
-        cn=conn_list_first(&(cs.cl));
-        while(cn)
-        {
-            FD_SET(cn->read_fd, &rfs);
-            fscount(n, cn->read_fd);
-            if (debug>1)
-                printf("SERVER: Adding select fd %d from conn\n", cn->read_fd);
+/* add a connection, and register it with the event loop */
+static void suq_serv_add_connection(suq_serv *cs, connection *cn)
+{
+    conn_list_add(&(cs->cl), cn);
+    if (event_add(&(cs->el), &(cn->ev), cn->read_fd, EVENT_READ, 
+                  suq_serv_conn_event, cn) < 0)
+    {
+        conn_list_remove(&(cs->cl), cn);
+    }
+}
+
+void suq_serv_main(suq_settings *st, int lock_fd, int pipe_in, int pipe_out)
+{
+    sig_handler sh;
+    event_source sig_ev;
+
+    suq_serv_init(&cs, st, lock_fd, pipe_in, pipe_out);
+    sig_handler_init(&sh);
+    event_source_init(&sig_ev);
+    if (event_add(&(cs.el), &sig_ev, sig_handler_get_reader(&sh), EVENT_READ,
+                  suq_serv_signal_event, &sh) < 0)
+        fatal_server_system_error("registering the signal handler");
+
+    /* now check for incoming data. */
+    do
+    {
+        int retval; /* event_loop_wait() return value */
+        long timeout; /* the timeout in ms, or -1 */
+
+        suq_serv_remove_closed(&cs);
+        if (cs.accept_retry)
+            suq_serv_accept_connection(&cs);
 
-            cn = conn_list_next(&(cs.cl), cn);
-        }
-         
         if (debug>0)
             printf("SERVER: waiting for input on %d connections...\n", 
                    conn_list_N(&(cs.cl))); 
 
-        retval=0;
-        retval=select(n+1, &rfs, NULL, NULL, NULL);
-
+        /* this handles everything that's ready: signals, job exits and
+           connections */
+        timeout=timer_wheel_timeout(&(cs.tw));
+        retval=event_loop_wait(&(cs.el), timeout);
+        if (retval < 0 && errno!=EAGAIN && errno!=EINTR)
+        {
+            fatal_server_system_error("Waiting for events failed");
+        }
         if (debug>1)
-            printf("SERVER: select returned %d\n", retval); 
+            printf("SERVER: %d events\n", retval); 
+
+        /* run the timers that expired */
+        timer_wheel_run(&(cs.tw));
 
         /* now check whether we can run new jobs */
         joblist_check_run(&(cs.jl), &cs);
 
-        if (retval < 0)
-        {
-            if (errno!=EAGAIN && errno!=EINTR)
-            {
-                fatal_server_system_error("Select failed");
-            }
-        }
-        else if (retval > 0)
-        {
-            if (FD_ISSET(shf, &rfs))
-            {
-                char dum[NSIGREAD];
-
-                if (read(shf, dum, NSIGREAD) < 0)
-                {
-                    fatal_server_system_error("sig handler read failed");
-                }
-                suq_serv_wait_proc(&cs);
-            }
-            if (FD_ISSET(cs.sockdes, &rfs))
-            {
-                suq_serv_accept_connection(&cs);
-            }
-            cn=cs.cl.head->next;
-            cn = conn_list_first(&(cs.cl));
-            while(cn)
-            {
-                /* we remember this beforehand, because the functions here 
-                   might remove the connection from the list */
-                connection *next=conn_list_next(&(cs.cl), cn); 
-                if (FD_ISSET(cn->read_fd, &rfs))
-                {
-                    if (connection_read(cn, &cs)==0)
-                    {
-                        cn->read_open=0;
-                        if (cn->keep_alive)
-                        {
-                            /* check whether it was a wait */
-                            jobwait *jw=joblist_wait_search_conn(&(cs.jl), cn);
-                            if (jw)
-                            {
-                                joblist_wait_remove(&(cs.jl), jw);
-                            }
-                        }
-                        conn_list_remove(&(cs.cl), cn);
-                        cn=NULL;
-                    }
-                    if (cn && !cn->keep_alive)
-                    {
-                        conn_list_remove(&(cs.cl), cn);
-                    }
-                }
-                cn = next;
-            }
-        }
         joblist_wait_check_finished_all( &(cs.jl), &(cs.cl) );
-    } while( (conn_list_N(&(cs.cl))>0) || (joblist_N(&(cs.jl))>0) ); 
 
-    suq_settings_write(cs.st);
-    
+        /* get this round's changes on disk before we confirm them */
+        journal_sync(&(cs.jn), &cs);
+        /* publish what changed, for 'suq ls' and 'suq info' */
+        snapshot_update(&(cs.snap), &cs);
+    } while( suq_serv_keep_running(&cs) ); 
+
+    event_del(&sig_ev);
     sig_handler_destroy(&sh);
     suq_serv_destroy(&cs);
 }
 
 
 
-void suq_serv_init(suq_serv *cs, suq_settings *st, int pipe_in, int pipe_out)
+void suq_serv_init(suq_serv *cs, suq_settings *st, int lock_fd, int pipe_in, 
+                   int pipe_out)
 { 
     int optval=1;
     struct sockaddr_un server_addr;
 
     cs->st=st;
+    cs->shutdown=0;
+
+    /* only one server may have the socket: the one with the lock */
+    cs->lock_fd=lock_fd;
+    if (cs->lock_fd < 0)
+    {
+        cs->lock_fd=open(cs->st->lock_filename, O_RDWR|O_CREAT|O_CLOEXEC, 
+                         S_IRUSR|S_IWUSR);
+        if (cs->lock_fd < 0)
+            fatal_server_system_error("opening the server lock file");
+        if (flock(cs->lock_fd, LOCK_EX|LOCK_NB) < 0)
+        {
+            if (errno == EWOULDBLOCK)
+                fatal_server_error("another server is running");
+            fatal_server_system_error("locking the server lock file");
+        }
+    }
+    event_loop_init(&(cs->el));
+    event_source_init(&(cs->sock_ev));
+
+    /* every waiting client takes an fd, so we take all we may have */
+    if (getrlimit(RLIMIT_NOFILE, &(cs->nofile)) == 0)
+    {
+        struct rlimit rl=cs->nofile;
+
+        rl.rlim_cur=rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            server_system_error("setrlimit(RLIMIT_NOFILE)");
+    }
 
     joblist_init(&(cs->jl)); /* create an empty job list */
+    timer_wheel_init(&(cs->tw)); /* with no timers yet */
+    /* before we move into a cgroup of our own */
+    capacity_detect(&(cs->cap));
+    printf("SERVER: capacity is %d cpus and %lld MB memory (%s)\n", 
+           cs->cap.ncpu, cs->cap.mem/(1024*1024), cs->cap.reason);
+    if (cs->st->ntask > cs->cap.ncpu)
+        printf("SERVER: ntask %d is more than the %d cpus available\n",
+               cs->st->ntask, cs->cap.ncpu);
+    cpu_alloc_init(&(cs->ca));
+    cgroup_tree_init(&(cs->cg));
+    cpu_stat_init(&(cs->cpustat));
+    cs->cpu_idle=-1;
+    timer_init(&(cs->tree_timer), suq_serv_tree_timer, cs);
+    timer_init(&(cs->sample_timer), suq_serv_sample_timer, cs);
+    timer_init(&(cs->linger_timer), suq_serv_linger_timer, cs);
+    cs->lingered=0;
+
+#ifdef PR_SET_CHILD_SUBREAPER
+    /* become the reaper for all orphaned descendants of our jobs, so that
+       processes that outlive a job's main process remain accounted to it */
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+        server_system_error("prctl(PR_SET_CHILD_SUBREAPER)");
+#endif
     conn_list_init(&(cs->cl)); /* and a new connection list */
+    jobwatch_list_init(&(cs->wl));
+    snapshot_writer_init(&(cs->snap), cs->st->snap_filename);
+    /* get back the jobs of the last server, if it didn't finish them */
+    journal_init(&(cs->jn), cs->st->journal_filename);
+    if (journal_replay(&(cs->jn), cs) > 0)
+        cs->snap.dirty=1;
 
     /* we chdir to / */
     if (chdir("/") < 0)
         server_system_error("chdir to / failed");
 
-    /* open AF_UNIX socket */
+    memset(&(cs->stats), 0, sizeof(cs->stats));
+    cs->stats.start_time=time(NULL);
+    cs->accept_retry=0;
+
+    /* open AF_UNIX socket. Jobs mustn't inherit it. */
+#ifdef SOCK_CLOEXEC
+    cs->sockdes = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+#else
     cs->sockdes = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (cs->sockdes >= 0)
+        fcntl(cs->sockdes, F_SETFD, 1);
+#endif
     if (cs->sockdes < 0)
         fatal_server_system_error("listening socket failed");
 
@@ -209,7 +355,8 @@ void suq_serv_init(suq_serv *cs, suq_settings *st, int pipe_in, int pipe_out)
                    sizeof(optval))<0)
         fatal_server_system_error("socket options");
 
-    /* we remove the socket file but don't check the results*/
+    /* we remove the socket file of a server that died but don't check the
+       results */
     unlink(cs->st->sock_filename);
 
     memset(&server_addr,0,sizeof(server_addr)); /* reset values */
@@ -226,8 +373,11 @@ void suq_serv_init(suq_serv *cs, suq_settings *st, int pipe_in, int pipe_out)
     chmod(cs->st->sock_filename, S_IRUSR|S_IWUSR);
 
     /* and listen */
-    if (listen(cs->sockdes, 10)<0)
+    if (listen(cs->sockdes, cs->st->backlog)<0)
         fatal_server_system_error("server listen failed");
+    if (event_add(&(cs->el), &(cs->sock_ev), cs->sockdes, EVENT_READ, 
+                  suq_serv_sock_event, cs) < 0)
+        fatal_server_system_error("registering the server socket");
 
 
     if (debug>0)
@@ -235,75 +385,466 @@ void suq_serv_init(suq_serv *cs, suq_settings *st, int pipe_in, int pipe_out)
 
 
     if (pipe_in>0 && pipe_out>0)
-        conn_list_add(&(cs->cl), connection_new(pipe_in, pipe_out));
+        suq_serv_add_connection(cs, connection_new(pipe_in, pipe_out));
 
     /* we now have a bound socket that we can listen() to */
 }
 
 
+/* stop being the server that clients find: remove the socket and the
+   snapshot file, leave the journal with the jobs we have now, and give up
+   the lock, so that a new server can start while we finish what we have.
+   What happens after that isn't journaled. */
+static void suq_serv_retire(suq_serv *cs)
+{
+    if (cs->sockdes >= 0)
+    {
+        /* Clients that connected before the socket file is gone are in 
+           the accept queue; we serve those before we go. Others find no
+           server, and start a new one once we've given up the lock. */
+        unlink(cs->st->sock_filename);
+        suq_serv_accept_connection(cs);
+        event_del(&(cs->sock_ev));
+        close(cs->sockdes);
+        cs->sockdes=-1;
+    }
+    snapshot_writer_stop(&(cs->snap));
+    if (cs->lock_fd >= 0)
+    {
+        /* the next server goes on from our jobs and job ids, which only
+           the journal has: the settings file leaves out next_id (see
+           SUQ_SETTINGS_NEXT_ID). It does get the settings that were 
+           changed while we ran, such as ntask. */
+        journal_sync(&(cs->jn), cs);
+        journal_compact(&(cs->jn), cs);
+        journal_destroy(&(cs->jn));
+        suq_settings_write(cs->st);
+        close(cs->lock_fd);
+        cs->lock_fd=-1;
+    }
+}
+
 void suq_serv_destroy(suq_serv *cs)
 {
-    /* we just unlink the file */
-    unlink(cs->st->sock_filename);
+    /* we unlink the files, unless we gave them up already */
+    suq_serv_retire(cs);
 
+    jobwatch_list_destroy(&(cs->wl));
+    snapshot_writer_destroy(&(cs->snap));
     conn_list_destroy(&(cs->cl));
     joblist_destroy(&(cs->jl));
+    cpu_stat_destroy(&(cs->cpustat));
+    cpu_alloc_destroy(&(cs->ca));
+    cgroup_tree_destroy(&(cs->cg));
+    event_loop_destroy(&(cs->el));
 }
 
 void suq_serv_accept_connection(suq_serv *cs)
 {
-    /* accept incoming connection */
-    int nfd=accept(cs->sockdes, NULL, NULL);
-    if (nfd < 0)
-        fatal_server_system_error("server connection accept failed");
+    int n=0;
 
-    if (debug>0)
-        printf("SERVER: accepted connection\n"); 
+    cs->accept_retry=0;
+    /* the socket is edge-triggered, so we take all waiting connections */
+    while(cs->sockdes >= 0)
+    {
+#if defined(SOCK_NONBLOCK) && defined(SOCK_CLOEXEC)
+        int nfd=accept4(cs->sockdes, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
+        /* connection_new() and event_add() set the flags */
+        int nfd=accept(cs->sockdes, NULL, NULL);
+#endif
+        if (nfd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                /* out of fds, for example. The socket won't tell us about
+                   the connections that are still waiting, so we try again
+                   after the next round. */
+                server_system_error("server connection accept failed");
+                cs->stats.accept_errors++;
+                cs->accept_retry=1;
+            }
+            break;
+        }
+
+        if (debug>0)
+            printf("SERVER: accepted connection\n"); 
    
-    conn_list_add(&(cs->cl), connection_new(nfd, nfd));
+        suq_serv_add_connection(cs, connection_new(nfd, nfd));
+        n++;
+    }
+
+    if (n > 0)
+    {
+        cs->stats.accepted += n;
+        cs->stats.accept_wakeups++;
+        cs->stats.accept_last=n;
+        if (n > cs->stats.accept_max)
+            cs->stats.accept_max=n;
+    }
 }
 
-void suq_serv_wait_proc(suq_serv *cs)
+void suq_serv_handle_signal(suq_serv *cs, int sig)
 {
-    pid_t ret;
-    int status;
+    if (debug>1)
+        printf("SERVER: got signal %d\n", sig);
 
-    do
+    switch(sig)
     {
-        ret=wait4(-1, &status, WNOHANG , NULL);
+        case SIGCHLD:
+            suq_serv_wait_proc(cs);
+            break;
+        case SIGUSR1:
+            /* just a wakeup: re-check the queue */
+            joblist_check_run(&(cs->jl), cs);
+            break;
+        case SIGUSR2:
+            suq_serv_dump(cs);
+            break;
+        case SIGHUP:
+            printf("SERVER: SIGHUP: re-reading settings\n");
+            suq_settings_read(cs->st);
+            cs->snap.dirty=1;
+            joblist_check_ntask(&(cs->jl), cs);
+            joblist_check_run(&(cs->jl), cs);
+            break;
+        case SIGTERM:
+            suq_serv_shutdown(cs);
+            break;
+    }
+}
+
+void suq_serv_kill_job(suq_serv *cs, job *j)
+{
+    if (j->state != running && j->state != started)
+        return;
+    /* don't restart the escalation if it's already under way */
+    if (j->kill_state > 0)
+        return;
+
+    job_cancel(j, SIGTERM);
+    timer_add(&(cs->tw), &(j->timer), cs->st->kill_grace*1000UL);
+}
+
+void suq_serv_job_timer(suq_timer *t, void *data)
+{
+    job *j=(job*)data;
+
+    if (j->state != running && j->state != started)
+        return;
+
+    if (j->kill_state == 0)
+    {
+        /* this was the walltime limit */
+        printf("SERVER: job %d (%s) exceeded its walltime of %d s\n", 
+               j->id, j->name, j->walltime);
+        suq_serv_kill_job(&cs, j);
+        return;
+    }
+
+    /* the job survived the previous signal: send SIGKILL, and keep
+       doing so until the job is reaped */
+    if (j->kill_state > 1)
+    {
+        printf("SERVER: job %d (%s), process group %d, is still alive; "
+               "sending SIGKILL again\n", j->id, j->name, j->pid);
+    }
+    job_cancel(j, SIGKILL);
+    timer_add(&(cs.tw), t, cs.st->kill_grace*1000UL);
+}
+
+void suq_serv_sample_timer(suq_timer *t, void *data)
+{
+    suq_serv *cs=(suq_serv*)data;
+    job *j;
+
+    joblist_sample(&(cs->jl));
+    cs->snap.dirty=1;
+    /* only the cpus we may use count */
+    cs->cpu_idle=sample_cpu_idle(&(cs->cpustat), cs->ca.cpus, cs->ca.ncpu);
+    joblist_check_oversub(&(cs->jl), cs);
+    /* re-accounting may have changed what fits */
+    joblist_check_run(&(cs->jl), cs);
 
-        if (ret>0)
+    /* keep sampling as long as there are running jobs */
+    j=joblist_first(&(cs->jl));
+    while(j)
+    {
+        if (j->state == running && cs->st->sample_interval > 0)
         {
-            /* find the job */
-            job *j=joblist_first( &(cs->jl) );
-            job *j_found=NULL;
+            timer_add(&(cs->tw), t, cs->st->sample_interval*1000UL);
+            return;
+        }
+        j=joblist_next(&(cs->jl), j);
+    }
+    /* the next measurement starts from scratch */
+    cs->cpustat.valid=0;
+    cs->cpu_idle=-1;
+}
 
-            /* a process really quit */
-            if (debug>1)
-                printf("SERVER: CHILD pid=%d CAUGHT\n", ret);
+int suq_serv_ncpu(suq_serv *cs)
+{
+    return (cs->ca.ncpu > 0) ? cs->ca.ncpu : cs->st->ntask;
+}
 
-            while (j)
+void suq_serv_shutdown(suq_serv *cs)
+{
+    job *j;
+    connection *cn;
+
+    if (cs->shutdown)
+        return;
+    cs->shutdown=1;
+    printf("SERVER: SIGTERM: shutting down\n");
+
+    /* drop the waits and watches, which would otherwise keep us here. The
+       other connections get the answers to what they've sent. */
+    cn=conn_list_first(&(cs->cl));
+    while(cn)
+    {
+        connection *next=conn_list_next(&(cs->cl), cn);
+        if (suq_serv_drop_conn(cs, cn) > 0)
+            conn_list_remove(&(cs->cl), cn);
+        cn=next;
+    }
+
+    /* stop taking new connections; a new client will start a new server.
+       The ones that were already waiting to be accepted are served too. */
+    suq_serv_retire(cs);
+
+    /* kill the running jobs, and forget the rest. We stay around until 
+       the running ones have been reaped. */
+    j=joblist_first(&(cs->jl));
+    while(j)
+    {
+        job *next=joblist_next(&(cs->jl), j);
+        if (j->state == running || j->state == started)
+            suq_serv_kill_job(cs, j);
+        else
+            joblist_remove(&(cs->jl), j);
+        j=next;
+    }
+}
+
+void suq_serv_event(suq_serv *cs, job *j, const char *event, 
+                    const char *detail)
+{
+    char line[512];
+
+    /* every event is a change of the queue */
+    cs->snap.dirty=1;
+    journal_event(&(cs->jn), j, event);
+    if (cs->wl.N == 0)
+        return;
+    snprintf(line, sizeof(line), "%ld %s %d %s%s%s\n", (long)time(NULL),
+             event, j->id, j->name, detail ? " " : "", detail ? detail : "");
+    jobwatch_list_send(&(cs->wl), j, line);
+}
+
+void suq_serv_dump(suq_serv *cs)
+{
+    job *j;
+    time_t now=time(NULL);
+    char timestr[26];
+    char *loc;
+
+    ctime_r(&now, timestr);
+    loc=strchr(timestr, '\n'); /* remove newline */
+    if (loc)
+        *loc=0;
+    printf("%s: status: %d jobs, %d connections, max tasks %d\n", timestr,
+           joblist_N(&(cs->jl)), conn_list_N(&(cs->cl)), cs->st->ntask);
+    j=joblist_first(&(cs->jl));
+    while(j)
+    {
+        printf("    job %d (%s): %s, prio %d, ntask %d", j->id, j->name, 
+               job_state_strings[j->state], j->prio, j->ntask);
+        if (j->state == running || j->state == started)
+            printf(", pid %d", j->pid);
+        printf("\n");
+        j=joblist_next(&(cs->jl), j);
+    }
+    fflush(stdout);
+}
+
+void suq_serv_wait_proc(suq_serv *cs)
+{
+    /* Reap all children that have exited. We peek at them first, so that
+       job main processes get reaped by job_reap(). Besides those, we are 
+       the parent of orphaned job processes because we are a subreaper. */
+    for(;;)
+    {
+        siginfo_t info;
+        job *j;
+
+        info.si_pid=0;
+        if (waitid(P_ALL, 0, &info, WEXITED|WNOHANG|WNOWAIT) < 0)
+        {
+            if (errno != ECHILD && errno != EINTR)
+                server_system_error("waitid");
+            break;
+        }
+        if (info.si_pid == 0)
+            break;
+
+        j=joblist_first( &(cs->jl) );
+        while(j)
+        {
+            if (job_has_process(j, info.si_pid))
+                break;
+            j=joblist_next( &(cs->jl), j);
+        }
+
+        if (j && !j->leader_done && j->pid == info.si_pid)
+        {
+            suq_serv_reap_job(cs, j);
+        }
+        else
+        {
+            int status;
+            struct rusage ru;
+
+            /* it has exited already, so this doesn't block */
+            if (wait4(info.si_pid, &status, 0, &ru) < 0)
+            {
+                server_system_error("wait4");
+                break;
+            }
+            if (debug>1)
+                printf("SERVER: reaped pid=%d of job %d\n", info.si_pid, 
+                       j ? j->id : -1);
+            if (j)
             {
-                job *next=joblist_next( &(cs->jl), j);
-
-                if ( (j->state==running || j->state==started) && 
-                     (j->pid == ret))
-                {
-                    j_found=j;
-                    j->state=done;
-                    j->end_time=time(NULL);
-                    break;
-                }
-                j=next;
+                job_add_rusage(j, &ru);
+                job_remove_stray(j, info.si_pid);
+                /* its children are ours now */
+                suq_serv_adopt(cs, j);
+                suq_serv_check_tree(cs, j);
             }
-            if (!j_found)
+            else
             {
-                if (debug>1)
-                    printf("SERVER: ERROR child not found\n");
+                suq_serv_adopt(cs, NULL);
             }
         }
-    } while (ret>0);
+    }
 
     joblist_check_run(&(cs->jl), cs);
 }
 
+void suq_serv_reap_job(suq_serv *cs, job *j)
+{
+    if (!job_reap(j))
+        return;
+    cs->snap.dirty=1;
+
+    /* the main process's children are re-parented to us when it exits */
+    suq_serv_adopt(cs, j);
+    if (job_tree_alive(j))
+    {
+        printf("SERVER: job %d (%s): main process exited; %s its remaining "
+               "processes\n", j->id, j->name, 
+               cs->st->kill_strays ? "killing" : "waiting for");
+        if (cs->st->kill_strays)
+            suq_serv_kill_job(cs, j);
+    }
+    suq_serv_check_tree(cs, j);
+}
+
+void suq_serv_adopt(suq_serv *cs, job *hint)
+{
+    char filename[MAXPATHLEN];
+    FILE *in;
+    int pid;
+
+    /* the list of our own children */
+    snprintf(filename, MAXPATHLEN, "/proc/self/task/%d/children", getpid());
+    in=fopen(filename, "r");
+    if (!in)
+        return;
+    while(fscanf(in, "%d", &pid) == 1)
+    {
+        job *j=joblist_first( &(cs->jl) );
+        job *owner=NULL;
+        pid_t pgid;
+
+        while(j)
+        {
+            if (job_has_process(j, pid))
+                break;
+            j=joblist_next( &(cs->jl), j);
+        }
+        if (j)
+            continue;
+
+        /* a new one: it belongs to the job with its process group if there
+           is one, and otherwise to the job whose process just exited */
+        pgid=getpgid(pid);
+        j=joblist_first( &(cs->jl) );
+        while(j)
+        {
+            if ( (j->state == running || j->state == started) && 
+                 j->pid == pgid)
+            {
+                owner=j;
+                break;
+            }
+            j=joblist_next( &(cs->jl), j);
+        }
+        if (!owner)
+            owner=hint;
+        if (owner)
+        {
+            if (debug>1)
+                printf("SERVER: adopting pid %d into job %d\n", pid, 
+                       owner->id);
+            job_add_stray(owner, pid);
+            if (owner->kill_state > 0)
+                kill(pid, SIGTERM);
+        }
+    }
+    fclose(in);
+}
+
+void suq_serv_check_tree(suq_serv *cs, job *j)
+{
+    if (!j->leader_done || (j->state != running && j->state != started))
+        return;
+
+    if (!job_tree_alive(j))
+    {
+        j->state=done;
+        j->end_time=time(NULL);
+        gettimeofday(&(j->end_tv), NULL);
+        timer_del(&(j->timer));
+    }
+    else if (!timer_active(&(cs->tree_timer)))
+    {
+        timer_add(&(cs->tw), &(cs->tree_timer), TREE_CHECK_MS);
+    }
+}
+
+void suq_serv_linger_timer(suq_timer *t, void *data)
+{
+    suq_serv *cs=(suq_serv*)data;
+
+    if (debug>1)
+        printf("SERVER: idle for %d s; exiting\n", cs->st->linger);
+    cs->lingered=1;
+}
+
+void suq_serv_tree_timer(suq_timer *t, void *data)
+{
+    suq_serv *cs=(suq_serv*)data;
+    job *j;
+
+    /* pick up processes that were re-parented without us noticing */
+    suq_serv_adopt(cs, NULL);
+    j=joblist_first( &(cs->jl) );
+    while(j)
+    {
+        suq_serv_check_tree(cs, j);
+        j=joblist_next( &(cs->jl), j);
+    }
+}
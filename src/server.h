@@ -34,20 +34,61 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "connection.h"
 #include "job.h"
+#include "capacity.h"
+#include "watch.h"
+#include "snapshot.h"
+#include "journal.h"
 
 #include <signal.h>
+#include <sys/resource.h>
+
+/* counters for 'suq stats' */
+typedef struct serv_stats
+{
+    time_t start_time; /* when the server started */
+    unsigned long requests; /* the number of requests handled */
+    unsigned long accepted; /* the number of connections accepted */
+    unsigned long accept_wakeups; /* how often the socket had connections */
+    int accept_last; /* the connections accepted at the last wakeup */
+    int accept_max; /* the most accepted at one wakeup: the deepest the 
+                       accept queue has been seen */
+    unsigned long accept_errors; /* failed accepts, as for lack of fds */
+} serv_stats;
 
 /* the server state */
 typedef struct suq_serv
 {
     int sockdes; /* the listening socket */
+    int lock_fd; /* the server lock, held while we have the socket */
+    event_loop el; /* the event loop */
+    event_source sock_ev; /* the listening socket's event source */
+    struct rlimit nofile; /* the open file limit we started with */
     conn_list cl; /* the active connections */
+    jobwatch_list wl; /* the subscriptions to job events */
+    snapshot_writer snap; /* the published queue snapshot */
+    journal jn; /* the journal that the queue is restored from */
     joblist jl; /* the running jobs */
+    timer_wheel tw; /* the timers */
+    capacity cap; /* the resources available to jobs */
+    cpu_alloc ca; /* the allocation of cpus to jobs */
+    cgroup_tree cg; /* the cgroups of the jobs */
+    cpu_stat cpustat; /* the counters of our cpus at the last sample */
+    double cpu_idle; /* the idle cpus at the last sample, or -1 */
+    suq_timer tree_timer; /* re-checks jobs with stray processes */
+    suq_timer sample_timer; /* samples the running jobs */
+    suq_timer linger_timer; /* keeps us up for a while when idle */
+    int lingered; /* whether we've been idle for the whole linger time */
     /*int Nproc; *//* max number of processors to run on */
     /*unsigned int next_id; *//* next job id */
 
     /*char *sock_filename;*/
     suq_settings *st; /* settings */
+
+    serv_stats stats; /* the counters */
+    int accept_retry; /* whether accepting stopped before the queue was 
+                         empty, so we must try again */
+
+    int shutdown; /* whether we're shutting down after a SIGTERM */
 } suq_serv; 
 
 /* a global variable to allow signal handler access */
@@ -55,11 +96,13 @@ extern suq_serv cs;
 extern volatile sig_atomic_t sig_check;
 
 
-/* main loop of the suq_serv */
-void suq_serv_main(suq_settings *st, int pipe_in, int pipe_out);
+/* main loop of the suq_serv. lock_fd is the server lock if the client 
+   that started us took it, or -1. */
+void suq_serv_main(suq_settings *st, int lock_fd, int pipe_in, int pipe_out);
 
 /* initialize suq_serv structure */
-void suq_serv_init(suq_serv *cs, suq_settings *st, int pipe_in, int pipe_out);
+void suq_serv_init(suq_serv *cs, suq_settings *st, int lock_fd, int pipe_in, 
+                   int pipe_out);
 
 /* destroy suq_serv structure contents */
 void suq_serv_destroy(suq_serv *cs);
@@ -67,9 +110,56 @@ void suq_serv_destroy(suq_serv *cs);
 /* accept connection */
 void suq_serv_accept_connection(suq_serv *cs);
 
-/* wait for finished processes after we got a signal */
+/* handle a signal read from the signal handler */
+void suq_serv_handle_signal(suq_serv *cs, int sig);
+
+/* kill a running job: SIGTERM first, and SIGKILL after a grace period */
+void suq_serv_kill_job(suq_serv *cs, job *j);
+
+/* the expiry function for job timers: walltime limits and kill 
+   escalation */
+void suq_serv_job_timer(suq_timer *t, void *data);
+
+/* the expiry function of the timer that samples running jobs */
+void suq_serv_sample_timer(suq_timer *t, void *data);
+
+/* the event function for job pidfds */
+void suq_serv_pidfd_event(event_source *es, int events, void *data);
+
+/* get the number of cpus the jobs can use */
+int suq_serv_ncpu(suq_serv *cs);
+
+/* kill all running jobs, drop the rest, and stop accepting connections */
+void suq_serv_shutdown(suq_serv *cs);
+
+/* report an event for job j (such as "started") to the clients that 
+   watch it, with optional details */
+void suq_serv_event(suq_serv *cs, job *j, const char *event, 
+                    const char *detail);
+
+/* write the server state to the log */
+void suq_serv_dump(suq_serv *cs);
+
+/* reap all finished processes after we got a SIGCHLD */
 void suq_serv_wait_proc(suq_serv *cs);
 
+/* reap a job's main process, if it has exited */
+void suq_serv_reap_job(suq_serv *cs, job *j);
+
+/* attribute children that were re-parented to us to their jobs. Children
+   that can't be attributed otherwise go to hint, if it's not NULL */
+void suq_serv_adopt(suq_serv *cs, job *hint);
+
+/* mark a job as done if its main process and all its descendants are 
+   gone */
+void suq_serv_check_tree(suq_serv *cs, job *j);
+
+/* the expiry function of the timer that ends the linger time */
+void suq_serv_linger_timer(suq_timer *t, void *data);
+
+/* the expiry function of the timer that re-checks job process trees */
+void suq_serv_tree_timer(suq_timer *t, void *data);
+
 #endif
 
 
@@ -51,6 +51,7 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "err.h"
 #include "settings.h"
+#include "capacity.h"
 
 
 
@@ -58,8 +59,16 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 static char *get_sockname(void);
 
 
+/* get the file name of the queue snapshot, next to the socket */
+static char *get_snap_filename(void);
+/* get the file name of the server lock file */
+static char *get_lock_filename(void);
+
 /* get the file name of the log file */
 static char *get_log_filename(const char *full_dirname, const char *hostname);
+/* get the file name of the job journal */
+static char *get_journal_filename(const char *full_dirname, 
+                                  const char *hostname);
 /* get the file name of the settings file */
 static char *get_settings_filename(const char *full_dirname, const char *hostname);
 /* get the file name of the settings file */
@@ -94,6 +103,26 @@ char *get_sockname(void)
     return sockname;
 }
 
+char *get_snap_filename(void)
+{
+    char *filename;
+
+    filename=malloc_check_server(sizeof(char)*MAXPATHLEN);
+    snprintf(filename, MAXPATHLEN, "/tmp/.suq.%d/suq.snap", (int)getuid());
+
+    return filename;
+}
+
+char *get_lock_filename(void)
+{
+    char *filename;
+
+    filename=malloc_check_server(sizeof(char)*MAXPATHLEN);
+    snprintf(filename, MAXPATHLEN, "/tmp/.suq.%d/suq.lock", (int)getuid());
+
+    return filename;
+}
+
 char *get_log_filename(const char *full_dirname, const char *hostname)
 {
     char *filename;
@@ -105,6 +134,16 @@ char *get_log_filename(const char *full_dirname, const char *hostname)
     return filename;
 }
 
+char *get_journal_filename(const char *full_dirname, const char *hostname)
+{
+    char *filename;
+
+    filename=malloc_check_server(sizeof(char)*MAXPATHLEN);
+    snprintf(filename, MAXPATHLEN, "%s/%s.journal", full_dirname, hostname);
+
+    return filename;
+}
+
 char *get_settings_filename(const char *full_dirname, const char *hostname)
 {
     char *filename;
@@ -129,6 +168,127 @@ char *get_settings_tmpname(const char *settings_filename)
 
 
 
+/* add a scheduling band, keeping them sorted by max_prio. A band with 
+   the same max_prio is replaced. */
+static void settings_add_band(suq_settings *st, int max_prio, int nice, 
+                              int policy, int ioclass, int iolevel)
+{
+    prio_band b;
+    int i;
+
+    b.max_prio=max_prio;
+    b.nice=nice;
+    b.policy=policy;
+    b.ioclass=ioclass;
+    b.iolevel=iolevel;
+
+    for(i=0;i<st->nbands;i++)
+    {
+        if (st->bands[i].max_prio == max_prio)
+        {
+            st->bands[i]=b;
+            return;
+        }
+    }
+    if (st->nbands >= MAX_BANDS)
+        return;
+    i=st->nbands++;
+    while(i>0 && st->bands[i-1].max_prio > max_prio)
+    {
+        st->bands[i]=st->bands[i-1];
+        i--;
+    }
+    st->bands[i]=b;
+}
+
+/* parse a scheduling band max:nice:policy:io, where max is a priority or 
+   '*', policy is other, batch or idle, and io is none, be/N or idle. 
+   Returns 0 on success. */
+static int settings_parse_band(suq_settings *st, char *val)
+{
+    char *fields[4];
+    char *end;
+    int max_prio, nice, policy, ioclass=IOCLASS_NONE, iolevel=0;
+    int i;
+
+    fields[0]=val;
+    for(i=1;i<4;i++)
+    {
+        fields[i]=strchr(fields[i-1], ':');
+        if (!fields[i])
+            return -1;
+        *(fields[i]++)=0;
+    }
+
+    if (strcmp(fields[0], "*")==0)
+        max_prio=INT_MAX;
+    else
+    {
+        max_prio=strtol(fields[0], &end, 10);
+        if (end==fields[0] || *end)
+            return -1;
+    }
+    nice=strtol(fields[1], &end, 10);
+    if (end==fields[1] || *end || nice < -20 || nice > 19)
+        return -1;
+
+    if (strcmp(fields[2], "other")==0)
+        policy=SCHED_OTHER;
+    else if (strcmp(fields[2], "batch")==0)
+        policy=SCHED_BATCH;
+    else if (strcmp(fields[2], "idle")==0)
+        policy=SCHED_IDLE;
+    else
+        return -1;
+
+    if (strcmp(fields[3], "idle")==0)
+        ioclass=IOCLASS_IDLE;
+    else if (strncmp(fields[3], "be/", 3)==0)
+    {
+        ioclass=IOCLASS_BE;
+        iolevel=strtol(fields[3]+3, &end, 10);
+        if (end==fields[3]+3 || *end || iolevel<0 || iolevel>7)
+            return -1;
+    }
+    else if (strcmp(fields[3], "none")!=0)
+        return -1;
+
+    settings_add_band(st, max_prio, nice, policy, ioclass, iolevel);
+    return 0;
+}
+
+const prio_band *suq_settings_get_band(suq_settings *st, int prio)
+{
+    int i;
+
+    for(i=0;i<st->nbands;i++)
+    {
+        if (prio <= st->bands[i].max_prio)
+            return &(st->bands[i]);
+    }
+    return NULL;
+}
+
+void suq_settings_band_string(const prio_band *b, char *buf, size_t len)
+{
+    char maxstr[16];
+    char iostr[16];
+
+    if (b->max_prio == INT_MAX)
+        snprintf(maxstr, sizeof(maxstr), "*");
+    else
+        snprintf(maxstr, sizeof(maxstr), "%d", b->max_prio);
+    if (b->ioclass == IOCLASS_BE)
+        snprintf(iostr, sizeof(iostr), "be/%d", b->iolevel);
+    else
+        snprintf(iostr, sizeof(iostr), "%s",
+                 (b->ioclass == IOCLASS_IDLE) ? "idle" : "none");
+
+    snprintf(buf, len, "%s:%d:%s:%s", maxstr, b->nice, 
+             (b->policy == SCHED_IDLE) ? "idle" :
+             (b->policy == SCHED_BATCH) ? "batch" : "other", iostr);
+}
+
 void suq_settings_init(suq_settings *st, const char *dirname)
 {
     char hostname[_POSIX_HOST_NAME_MAX+1];
@@ -147,22 +307,33 @@ void suq_settings_init(suq_settings *st, const char *dirname)
 
 
     /* set the default settings */
-#if defined(_SC_NPROCESSORS_ONLN)
-    st->ntask=sysconf(_SC_NPROCESSORS_ONLN);
-#elif defined(_SC_NPROC_ONLN)
-    st->ntask=sysconf(_SC_NPROC_ONLN);
-#elif defined(_SC_NPROCESSORS_CONF)
-    st->ntask=sysconf(_SC_NPROCESSORS_CONF);
-#elif defined(_SC_NPROC_CONF)
-    st->ntask=sysconf(_SC_NPROC_CONF);
-#else
-    st->ntask=1;
-#endif
+    {
+        capacity cap;
+
+        capacity_detect(&cap);
+        st->ntask=cap.ncpu;
+    }
+    st->kill_grace=10;
+    st->backlog=1024;
+    st->kill_strays=0;
+    st->sample_interval=5;
+    st->linger=60;
+    st->oversub=OVERSUB_NONE;
+    st->job_env=JOB_ENV_ALL;
+    /* by default, queued jobs don't compete with interactive work, and
+       low priority jobs only get what's left */
+    st->nbands=0;
+    settings_add_band(st, INT_MAX, 0, SCHED_BATCH, IOCLASS_NONE, 0);
+    settings_add_band(st, -1, 10, SCHED_BATCH, IOCLASS_BE, 7);
+    settings_add_band(st, -10, 19, SCHED_IDLE, IOCLASS_IDLE, 0);
     st->next_id=0;
     gethostname(hostname, _POSIX_HOST_NAME_MAX);
     st->settings_filename=get_settings_filename(st->fulldirname, hostname);
     st->sock_filename=get_sockname();
+    st->snap_filename=get_snap_filename();
+    st->lock_filename=get_lock_filename();
     st->log_filename=get_log_filename(st->fulldirname, hostname);
+    st->journal_filename=get_journal_filename(st->fulldirname, hostname);
 
     st->settings_tmpname=get_settings_tmpname(st->settings_filename);
 
@@ -201,7 +372,10 @@ void suq_settings_destroy(suq_settings *st)
     free(st->settings_filename);
     free(st->settings_tmpname);
     free(st->sock_filename);
+    free(st->snap_filename);
+    free(st->lock_filename);
     free(st->log_filename);
+    free(st->journal_filename);
 }
 
 
@@ -214,6 +388,7 @@ void suq_settings_read(suq_settings *st)
     char name[READLEN], val[READLEN];
     int valn;
     char *end;
+    int nbands=0;
 
     in=fopen(st->settings_filename, "r");
     if (!in)
@@ -232,6 +407,60 @@ void suq_settings_read(suq_settings *st)
                 if (val!=end)
                     st->ntask=valn;
             }
+            else if (strcmp(name, "kill_grace")==0)
+            {
+                valn=strtol(val, &end, 0);
+                if (val!=end && valn>0)
+                    st->kill_grace=valn;
+            }
+            else if (strcmp(name, "backlog")==0)
+            {
+                valn=strtol(val, &end, 0);
+                if (val!=end && valn>0)
+                    st->backlog=valn;
+            }
+            else if (strcmp(name, "sample_interval")==0)
+            {
+                valn=strtol(val, &end, 0);
+                if (val!=end && valn>=0)
+                    st->sample_interval=valn;
+            }
+            else if (strcmp(name, "linger")==0)
+            {
+                valn=strtol(val, &end, 0);
+                if (val!=end && valn>=0)
+                    st->linger=valn;
+            }
+            else if (strcmp(name, "jobenv")==0)
+            {
+                if (strcmp(val, "none")==0)
+                    st->job_env=JOB_ENV_NONE;
+                else if (strcmp(val, "suq")==0)
+                    st->job_env=JOB_ENV_SUQ;
+                else
+                    st->job_env=JOB_ENV_ALL;
+            }
+            else if (strcmp(name, "oversub")==0)
+            {
+                if (strcmp(val, "account")==0)
+                    st->oversub=OVERSUB_ACCOUNT;
+                else if (strcmp(val, "affinity")==0)
+                    st->oversub=OVERSUB_AFFINITY;
+                else
+                    st->oversub=OVERSUB_NONE;
+            }
+            else if (strcmp(name, "strays")==0)
+            {
+                st->kill_strays = (strcmp(val, "kill")==0);
+            }
+            else if (strcmp(name, "band")==0)
+            {
+                /* the bands in the file replace the defaults */
+                if (nbands++ == 0)
+                    st->nbands=0;
+                if (settings_parse_band(st, val))
+                    fprintf(stderr, "Ignoring scheduling band '%s'\n", val);
+            }
 #ifdef SUQ_SETTINGS_NEXT_ID
             else if (strcmp(name, "next_id")==0)
             {
@@ -250,6 +479,8 @@ void suq_settings_read(suq_settings *st)
 void suq_settings_write(suq_settings *st)
 {
     FILE *out;
+    char band[64];
+    int i;
 
     out=fopen(st->settings_tmpname, "w");
     if (!out)
@@ -257,6 +488,30 @@ void suq_settings_write(suq_settings *st)
 
     if (fprintf(out, "ntask = %d\n", st->ntask) < 0)
         fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "kill_grace = %d\n", st->kill_grace) < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "sample_interval = %d\n", st->sample_interval) < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "backlog = %d\n", st->backlog) < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "linger = %d\n", st->linger) < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "jobenv = %s\n", 
+                (st->job_env == JOB_ENV_NONE) ? "none" :
+                (st->job_env == JOB_ENV_SUQ) ? "suq" : "all") < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "oversub = %s\n", 
+                (st->oversub == OVERSUB_ACCOUNT) ? "account" :
+                (st->oversub == OVERSUB_AFFINITY) ? "affinity" : "none") < 0)
+        fatal_server_system_error("write: Writing server settings");
+    if (fprintf(out, "strays = %s\n", st->kill_strays ? "kill" : "wait") < 0)
+        fatal_server_system_error("write: Writing server settings");
+    for(i=0;i<st->nbands;i++)
+    {
+        suq_settings_band_string(&(st->bands[i]), band, sizeof(band));
+        if (fprintf(out, "band = %s\n", band) < 0)
+            fatal_server_system_error("write: Writing server settings");
+    }
 
 #ifdef SUQ_SETTINGS_NEXT_ID
     if (fprintf(out, "next_id = %d\n", st->next_id) < 0)
@@ -32,15 +32,65 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __SETTINGS_H__
 #define __SETTINGS_H__
 
+#include <stddef.h>
+#include <sched.h>
+
+/* without these, the bands just set the nice value */
+#ifndef SCHED_BATCH
+#define SCHED_BATCH SCHED_OTHER
+#endif
+#ifndef SCHED_IDLE
+#define SCHED_IDLE SCHED_OTHER
+#endif
+
 /* uncomment this to remember the next job id */
 /*#define SUQ_SETTINGS_NEXT_ID */
 
+/* the policies for jobs that use more threads than their ntask */
+#define OVERSUB_NONE 0 /* only flag them */
+#define OVERSUB_ACCOUNT 1 /* account for the number of threads they use */
+#define OVERSUB_AFFINITY 2 /* restrict them to ntask cpus */
+
+/* which environment variables are added to jobs */
+#define JOB_ENV_NONE 0 /* none */
+#define JOB_ENV_SUQ 1 /* only the SUQ_ ones */
+#define JOB_ENV_ALL 2 /* the SUQ_ ones and the thread count knobs */
+
+/* the I/O scheduling classes; these are the kernel's values */
+#define IOCLASS_NONE 0 /* leave it as it is */
+#define IOCLASS_RT 1
+#define IOCLASS_BE 2
+#define IOCLASS_IDLE 3
+
+/* a scheduling band: running jobs with a priority up to max_prio (and 
+   above that of the previous band) get these scheduling settings */
+typedef struct prio_band
+{
+    int max_prio; /* the highest job priority in the band; INT_MAX for all */
+    int nice; /* the nice value */
+    int policy; /* SCHED_OTHER, SCHED_BATCH or SCHED_IDLE */
+    int ioclass; /* the I/O scheduling class */
+    int iolevel; /* the I/O priority within the class (0-7) */
+} prio_band;
+
+#define MAX_BANDS 8
+
 /* the client + server settings. These are read from the basedir that's 
     specified on the command line of the client, and passed on to the server
     once it is spawend. */
 typedef struct suq_settings
 {
     int ntask; /* max number of processors to run on */
+    int kill_grace; /* seconds between SIGTERM and SIGKILL for killed jobs */
+    int backlog; /* the listen backlog of the server socket */
+    int sample_interval; /* seconds between samples of running jobs, or 0 */
+    int linger; /* seconds the server stays up when idle */
+    int job_env; /* which environment variables are added to jobs */
+    int oversub; /* the policy for jobs with more threads than ntask */
+    prio_band bands[MAX_BANDS]; /* the scheduling bands, by max_prio */
+    int nbands; /* the number of scheduling bands */
+    int kill_strays; /* whether to kill processes that outlive a job's main 
+                        process, instead of waiting for them */
     unsigned int next_id; /* next job id */
 
     char *dirname; /* the base directory */
@@ -48,7 +98,10 @@ typedef struct suq_settings
     char *settings_filename; /* settings file name */
     char *settings_tmpname; /* temporary settings file name for writing*/
     char *sock_filename; /* socket file name */
+    char *snap_filename; /* queue snapshot file name */
+    char *lock_filename; /* the file a server locks while it has the socket */
     char *log_filename; /* log file name */
+    char *journal_filename; /* the journal of the queue's jobs */
 } suq_settings;
 
 
@@ -70,6 +123,12 @@ void suq_settings_write(suq_settings *st);
 
 /* set the max. number of tasks */
 void suq_settings_set_ntask(suq_settings *st, int ntask);
+/* get the scheduling band for job priority prio, or NULL if there is none */
+const prio_band *suq_settings_get_band(suq_settings *st, int prio);
+
+/* write a scheduling band as max:nice:policy:io into buf */
+void suq_settings_band_string(const prio_band *b, char *buf, size_t len);
+
 /* get the next job ID */
 int suq_settings_get_next_id(suq_settings *st);
 
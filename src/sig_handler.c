@@ -47,6 +47,9 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#ifdef __linux__
+#include <sys/signalfd.h>
+#endif
 
 
 
@@ -57,96 +60,146 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "job.h"
 #include "sig_handler.h"
 
+/* the signals we handle: SIGCHLD for finished jobs, and the rest for
+   control actions (see suq_serv_handle_signal()) */
+static const int handled_signals[] = { SIGCHLD, SIGUSR1, SIGUSR2, SIGHUP, 
+                                       SIGTERM, 0 };
+
+/* the signal mask from before sig_handler_init(), restored in children */
+static sigset_t orig_mask;
+
+#ifndef __linux__
 /* the local version that's accessible from the signal handler */
 static int sig2main;
 
 /* the actual signal handler */
 static void sig_handler_handle(int sig, siginfo_t *info, void *uap);
+#endif
 
 void sig_handler_init(sig_handler *sh)
 {
-    struct sigaction sa;
-    sigset_t set;
-    int pipes[2];
-
-
-    if (pipe(pipes) < 0)
-    {
-        fatal_server_system_error("Signal handler install failed (pipe)");
-    }
-
-    sh->sig2main = sig2main = pipes[1];
-    sh->main2sig = pipes[0];
-
-    fcntl(sh->sig2main, O_NONBLOCK); 
-    /* now set the close-on-exec flag because we don't want children to
-       inherit these. */
-    fcntl(sh->sig2main, F_SETFD, 1);
-    fcntl(sh->sig2main, F_SETFD, 1);
-
-#if 0
-    if (fcntl(sh->sig2main, O_NONBLOCK) < 0)
+    int i;
+
+    sigemptyset(&(sh->set));
+    for(i=0; handled_signals[i]; i++)
+        sigaddset(&(sh->set), handled_signals[i]);
+
+    /* a client that goes away before reading its reply should give us a
+       write error, not kill us */
+    signal(SIGPIPE, SIG_IGN);
+
+#ifdef __linux__
+    /* block the signals so they stay pending until we read them from the
+       signalfd */
+    if (sigprocmask(SIG_BLOCK, &(sh->set), &orig_mask) < 0)
+        fatal_server_system_error("Signal handler install failed (sigprocmask)");
+
+    sh->sig2main=-1;
+    sh->fd=signalfd(-1, &(sh->set), SFD_NONBLOCK|SFD_CLOEXEC);
+    if (sh->fd < 0)
+        fatal_server_system_error("Signal handler install failed (signalfd)");
+#else
     {
-        fatal_server_system_error("Signal handler install failed (fcntl)");
+        struct sigaction sa;
+        int pipes[2];
+
+        sigprocmask(SIG_BLOCK, NULL, &orig_mask);
+
+        if (pipe(pipes) < 0)
+        {
+            fatal_server_system_error("Signal handler install failed (pipe)");
+        }
+
+        sh->sig2main = sig2main = pipes[1];
+        sh->fd = pipes[0];
+
+        /* the handler must never block on a full pipe, and the main loop
+           drains it without blocking */
+        if ( (fcntl(sh->sig2main, F_SETFL, O_NONBLOCK) < 0) ||
+             (fcntl(sh->fd, F_SETFL, O_NONBLOCK) < 0) )
+        {
+            fatal_server_system_error("Signal handler install failed (fcntl)");
+        }
+        /* now set the close-on-exec flag because we don't want children to
+           inherit these. */
+        fcntl(sh->sig2main, F_SETFD, FD_CLOEXEC);
+        fcntl(sh->fd, F_SETFD, FD_CLOEXEC);
+
+        /* now attach signal handlers: */
+        sa.sa_sigaction = sig_handler_handle;
+        sa.sa_mask=sh->set;
+        sa.sa_flags=SA_NOCLDSTOP|SA_SIGINFO|SA_RESTART;
+
+        for(i=0; handled_signals[i]; i++)
+        {
+            if (sigaction(handled_signals[i], &sa, NULL ) < 0) 
+            {
+                fatal_server_system_error(
+                                "Signal handler install failed (sigaction)");
+            }
+        }
     }
 #endif
-    
-    /* now attach signal handlers: */
-    sigemptyset(&set);
-    sigaddset(&set, SIGCHLD);
-
-    sa.sa_sigaction = sig_handler_handle;
-    sa.sa_mask=set;
-    sa.sa_flags=SA_NOCLDSTOP;
-
-    if ( (sigaction(SIGCHLD, &sa, NULL ) < 0) ||
-         (sigaction(SIGUSR1, &sa, NULL ) < 0) )
-    {
-        fatal_server_system_error("Signal handler install failed (sigaction)");
-    }
 }
 
 int sig_handler_get_reader(sig_handler *sh)
 {
-    return sh->main2sig;
+    return sh->fd;
 }
 
-
-void sig_handler_destroy(sig_handler *sh)
+int sig_handler_read(sig_handler *sh)
 {
-    sigset_t set;
-
-    sigemptyset(&set);
-    sigaddset(&set, SIGCHLD);
-    sigprocmask(SIG_BLOCK, &set, NULL);
-
-    close(sh->sig2main);
-    close(sh->main2sig);
+#ifdef __linux__
+    struct signalfd_siginfo si;
+    ssize_t ret;
+
+    ret=read(sh->fd, &si, sizeof(si));
+    if (ret == sizeof(si))
+        return si.ssi_signo;
+#else
+    unsigned char sig;
+    ssize_t ret;
+
+    ret=read(sh->fd, &sig, 1);
+    if (ret == 1)
+        return sig;
+#endif
+    if (ret < 0 && errno!=EAGAIN && errno!=EINTR)
+        fatal_server_system_error("sig handler read failed");
+    return 0;
 }
 
-#if 0
-void sig_handler_block(sig_handler *sh)
+void sig_handler_child_reset(void)
 {
-    sigset_t set;
-
-    sigemptyset(&set);
-    sigaddset(&set, SIGCHLD);
-    sigprocmask(SIG_UNBLOCK, &set, NULL);
+#ifndef __linux__
+    int i;
+    for(i=0; handled_signals[i]; i++)
+        signal(handled_signals[i], SIG_DFL);
+#endif
+    signal(SIGPIPE, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &orig_mask, NULL);
 }
 
-void sig_handler_unblock(sig_handler *sh)
+void sig_handler_destroy(sig_handler *sh)
 {
-}
+#ifndef __linux__
+    /* block them from now on: there's nobody left to listen */
+    sigprocmask(SIG_BLOCK, &(sh->set), NULL);
+    close(sh->sig2main);
 #endif
+    close(sh->fd);
+}
 
+#ifndef __linux__
 void sig_handler_handle(int sig, siginfo_t *info, void *uap)
 {
-    char dum='s';
-
-    /* write a byte in non-blocking mode. This will be picked up
-       by the server's select() loop  */
-    if (write(sig2main, &dum, 1) < 0)
-        fatal_server_system_error("sig_handler write failed");
+    unsigned char sigc=(unsigned char)sig;
+    int saved_errno=errno;
+
+    /* write the signal number in non-blocking mode. This will be picked up
+       by the server's select() loop. If the pipe is full, a wakeup is 
+       already pending, so a failed write can safely be ignored. */
+    ignore_error(write(sig2main, &sigc, 1));
+    errno=saved_errno;
 }
-
-
+#endif
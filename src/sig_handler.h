@@ -32,13 +32,18 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef __SIG_HANDLER_H__
 #define __SIG_HANDLER_H__
 
-/* signal handler data. This is used to let the signal handler
-   write into a pipe that get checked with select() in the 
-   main server loop. This way we don't lose signals */
+#include <signal.h>
+
+/* signal handler data. On Linux, the signals we handle are blocked and
+   read from a signalfd that gets checked with select() in the main server 
+   loop. Elsewhere, a classic signal handler writes the signal number into
+   a pipe that is checked in the same way. This way we don't lose signals,
+   and never do any real work inside a signal handler. */
 typedef struct sig_handler
 {
-    /* the two pipes to keep open. */
-    int sig2main, main2sig; 
+    int fd; /* the signalfd, or the read end of the pipe */
+    int sig2main; /* the write end of the pipe, or -1 for a signalfd */ 
+    sigset_t set; /* the set of handled signals */
 } sig_handler;
 
 
@@ -49,6 +54,12 @@ void sig_handler_init(sig_handler *sh);
    arrived */
 int sig_handler_get_reader(sig_handler *sh);
 
+/* get the next pending signal number, or 0 if there are none left */
+int sig_handler_read(sig_handler *sh);
+
+/* restore the original signal mask in a forked child before exec() */
+void sig_handler_child_reset(void);
+
 /* uninstall the signal handler */
 void sig_handler_destroy(sig_handler *sh);
 
@@ -0,0 +1,647 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/param.h>
+
+#include "err.h"
+#include "settings.h"
+#include "job.h"
+#include "server.h"
+#include "snapshot.h"
+
+/* the initial size of the snapshot file */
+#define SNAP_FILE_SIZE (64*1024)
+/* how often a reader tries to get a consistent copy */
+#define SNAP_READ_TRIES 100
+
+
+/* make sure there's room for len more bytes of data */
+static void snap_reserve(snapshot_writer *sw, size_t len)
+{
+    if (sw->snap.size + len <= sw->alloc)
+        return;
+    while(sw->snap.size + len > sw->alloc)
+        sw->alloc = (sw->alloc > 0) ? 2*sw->alloc : SNAP_FILE_SIZE;
+    sw->snap.data=realloc_check_server(sw->snap.data, sw->alloc);
+}
+
+/* add a string to the data, and return its offset */
+static uint32_t snap_add_string(snapshot_writer *sw, const char *str)
+{
+    size_t len=strlen(str)+1;
+    uint32_t off=(uint32_t)sw->snap.size;
+
+    snap_reserve(sw, len);
+    memcpy(sw->snap.data + sw->snap.size, str, len);
+    sw->snap.size += len;
+    return off;
+}
+
+/* write the record of job j at index */
+static void snap_add_job(snapshot_writer *sw, size_t index, job *j, 
+                         int max_ntask)
+{
+    snap_job sj;
+    char str[64];
+
+    memset(&sj, 0, sizeof(sj));
+    sj.id=j->id;
+    sj.prio=j->prio;
+    sj.state=j->state;
+    sj.ntask=j->ntask;
+    sj.scavenger=j->scavenger;
+    sj.suspended=j->suspended;
+    sj.oversub=j->oversub;
+    sj.leader_done=j->leader_done;
+    sj.pid=j->pid;
+    sj.nsamples=j->smp.nsamples;
+    sj.nthread=j->smp.nthread;
+    sj.nthread_max=j->smp.nthread_max;
+    sj.ntask_acct=j->ntask_acct;
+    sj.ncpus=j->ncpus;
+    sj.walltime=j->walltime;
+    sj.argc=j->argc;
+    sj.envc=j->envc;
+    sj.sub_time=j->sub_time;
+    sj.start_time=j->start_time;
+    sj.end_time=j->end_time;
+    sj.mem_max=j->mem_max;
+
+    sj.name=snap_add_string(sw, j->name);
+    sj.cmd=snap_add_string(sw, j->cmd);
+    sj.wd=snap_add_string(sw, j->wd);
+    sj.out=snap_add_string(sw, j->stdout_filename);
+    if ((j->state==run_error || j->state==resource_error) && j->error_string)
+        sj.error=snap_add_string(sw, j->error_string);
+    if (j->has_band && j->state != waiting)
+    {
+        suq_settings_band_string(&(j->band), str, sizeof(str));
+        sj.band=snap_add_string(sw, str);
+    }
+    if (j->state == done)
+    {
+        job_exit_string(j, str, sizeof(str));
+        sj.result=snap_add_string(sw, str);
+        sj.utime=j->ru.ru_utime.tv_sec + j->ru.ru_utime.tv_usec*1e-6;
+        sj.stime=j->ru.ru_stime.tv_sec + j->ru.ru_stime.tv_usec*1e-6;
+        sj.maxrss=j->ru.ru_maxrss;
+        sj.inblock=j->ru.ru_inblock;
+        sj.oublock=j->ru.ru_oublock;
+        sj.efficiency=job_cpu_efficiency(j, max_ntask);
+        sj.cg_valid=j->cgs.valid;
+        sj.cg_usage=j->cgs.usage_usec*1e-6;
+        sj.cg_user=j->cgs.user_usec*1e-6;
+        sj.cg_system=j->cgs.system_usec*1e-6;
+        sj.cg_mem_peak=j->cgs.mem_peak;
+        sj.oom_kills=j->cgs.oom_kills;
+    }
+    memcpy(sw->snap.data + index*sizeof(snap_job), &sj, sizeof(snap_job));
+}
+
+/* rebuild the snapshot from the server's jobs */
+static void snap_build(snapshot_writer *sw, suq_serv *cs)
+{
+    snap_header *h=&(sw->snap.hdr);
+    size_t i=0;
+    job *j;
+
+    h->ntask=cs->st->ntask;
+    h->nrunning=0;
+    h->njobs=joblist_N(&(cs->jl));
+    h->ndone=0;
+    for(j=joblist_done_first(&(cs->jl)); j; 
+        j=joblist_done_next(&(cs->jl), j))
+        h->ndone++;
+
+    /* the records come first, then their strings */
+    sw->snap.size=0;
+    snap_reserve(sw, (h->njobs + h->ndone)*sizeof(snap_job));
+    sw->snap.size=(h->njobs + h->ndone)*sizeof(snap_job);
+    for(j=joblist_first(&(cs->jl)); j; j=joblist_next(&(cs->jl), j))
+    {
+        if (j->state == running && !j->scavenger)
+            h->nrunning += job_width(j, cs->st->ntask);
+        snap_add_job(sw, i++, j, cs->st->ntask);
+    }
+    for(j=joblist_done_first(&(cs->jl)); j; 
+        j=joblist_done_next(&(cs->jl), j))
+    {
+        snap_add_job(sw, i++, j, cs->st->ntask);
+    }
+    h->size=sw->snap.size;
+}
+
+/* give up on the file, so that clients use the socket */
+static void snap_abandon(snapshot_writer *sw)
+{
+    if (sw->map)
+    {
+        snap_header *h=(snap_header*)sw->map;
+
+        __atomic_store_n(&(h->pid), 0, __ATOMIC_RELEASE);
+        munmap(sw->map, sw->map_size);
+        sw->map=NULL;
+    }
+    if (sw->fd >= 0)
+    {
+        close(sw->fd);
+        unlink(sw->filename);
+        sw->fd=-1;
+    }
+}
+
+/* copy the snapshot into the file */
+static void snap_publish(snapshot_writer *sw)
+{
+    size_t need=sizeof(snap_header) + sw->snap.size;
+    snap_header *h;
+    uint32_t seq;
+
+    if (sw->fd < 0)
+        return;
+    if (need > sw->map_size)
+    {
+        /* grow the file; readers still have the smaller mapping, which 
+           stays valid */
+        size_t nsize=2*sw->map_size;
+        char *nmap;
+
+        while(nsize < need)
+            nsize *= 2;
+        if (ftruncate(sw->fd, nsize) < 0)
+        {
+            server_system_error("snapshot: ftruncate");
+            snap_abandon(sw);
+            return;
+        }
+        nmap=mmap(NULL, nsize, PROT_READ|PROT_WRITE, MAP_SHARED, sw->fd, 0);
+        if (nmap == MAP_FAILED)
+        {
+            server_system_error("snapshot: mmap");
+            snap_abandon(sw);
+            return;
+        }
+        munmap(sw->map, sw->map_size);
+        sw->map=nmap;
+        sw->map_size=nsize;
+    }
+
+    h=(snap_header*)sw->map;
+    seq=h->seq;
+    __atomic_store_n(&(h->seq), seq+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    h->size=sw->snap.hdr.size;
+    h->ntask=sw->snap.hdr.ntask;
+    h->nrunning=sw->snap.hdr.nrunning;
+    h->njobs=sw->snap.hdr.njobs;
+    h->ndone=sw->snap.hdr.ndone;
+    memcpy(sw->map + sizeof(snap_header), sw->snap.data, sw->snap.size);
+    __atomic_store_n(&(h->seq), seq+2, __ATOMIC_RELEASE);
+}
+
+void snapshot_writer_init(snapshot_writer *sw, const char *filename)
+{
+    char tmpname[MAXPATHLEN];
+    snap_header *h;
+
+    memset(sw, 0, sizeof(snapshot_writer));
+    sw->fd=-1;
+    sw->dirty=1;
+    sw->snap.hdr.magic=SNAP_MAGIC;
+    sw->snap.hdr.version=SNAP_VERSION;
+    sw->snap.hdr.pid=getpid();
+    sw->filename=strdup(filename);
+
+    /* a reader may still have the file of an earlier daemon mapped, which
+       we mustn't shrink under it: we make a new one and move it over */
+    snprintf(tmpname, MAXPATHLEN, "%s.%d", filename, (int)getpid());
+    sw->fd=open(tmpname, O_RDWR|O_CREAT|O_TRUNC|O_CLOEXEC, S_IRUSR|S_IWUSR);
+    if (sw->fd < 0)
+    {
+        server_system_error("snapshot: open");
+        return;
+    }
+    sw->map_size=SNAP_FILE_SIZE;
+    if (ftruncate(sw->fd, sw->map_size) < 0)
+    {
+        server_system_error("snapshot: ftruncate");
+        goto err;
+    }
+    sw->map=mmap(NULL, sw->map_size, PROT_READ|PROT_WRITE, MAP_SHARED, 
+                 sw->fd, 0);
+    if (sw->map == MAP_FAILED)
+    {
+        sw->map=NULL;
+        server_system_error("snapshot: mmap");
+        goto err;
+    }
+    h=(snap_header*)sw->map;
+    memcpy(h, &(sw->snap.hdr), sizeof(snap_header));
+    if (rename(tmpname, filename) < 0)
+    {
+        server_system_error("snapshot: rename");
+        goto err;
+    }
+    return;
+err:
+    unlink(tmpname);
+    if (sw->map)
+        munmap(sw->map, sw->map_size);
+    sw->map=NULL;
+    close(sw->fd);
+    sw->fd=-1;
+}
+
+void snapshot_writer_stop(snapshot_writer *sw)
+{
+    snap_abandon(sw);
+}
+
+void snapshot_writer_destroy(snapshot_writer *sw)
+{
+    snap_abandon(sw);
+    free(sw->snap.data);
+    free(sw->filename);
+    sw->snap.data=NULL;
+    sw->filename=NULL;
+}
+
+const snapshot *snapshot_update(snapshot_writer *sw, suq_serv *cs)
+{
+    if (sw->dirty)
+    {
+        snap_build(sw, cs);
+        snap_publish(sw);
+        sw->dirty=0;
+    }
+    return &(sw->snap);
+}
+
+
+
+/* check whether the daemon with pid still runs: it holds the server lock 
+   for as long as it is up. The pid alone may have been reused by now. */
+static int snap_daemon_alive(const char *lock_filename, pid_t pid)
+{
+    int fd;
+    int alive;
+
+    if (pid <= 0 || kill(pid, 0) != 0)
+        return 0; /* with EPERM, it belongs to someone else */
+    fd=open(lock_filename, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    alive=(flock(fd, LOCK_SH|LOCK_NB) < 0 && errno == EWOULDBLOCK);
+    close(fd);
+    return alive;
+}
+
+int snapshot_read(const char *filename, const char *lock_filename, 
+                  snapshot *s)
+{
+    int fd;
+    struct stat sb;
+    char *map=NULL;
+    size_t map_size=0;
+    const snap_header *h;
+    int i;
+    int ret=-1;
+
+    s->data=NULL;
+    s->size=0;
+    fd=open(filename, O_RDONLY|O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    for(i=0;i<SNAP_READ_TRIES;i++)
+    {
+        uint32_t seq;
+
+        /* (re)map the whole file: the daemon may have grown it */
+        if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(snap_header))
+            break;
+        if ((size_t)sb.st_size != map_size)
+        {
+            if (map)
+                munmap(map, map_size);
+            map_size=sb.st_size;
+            map=mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED)
+            {
+                map=NULL;
+                break;
+            }
+        }
+        h=(const snap_header*)map;
+        if (h->magic != SNAP_MAGIC || h->version != SNAP_VERSION)
+            break;
+
+        seq=__atomic_load_n(&(h->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            /* the daemon is writing it */
+            sched_yield();
+            continue;
+        }
+        memcpy(&(s->hdr), h, sizeof(snap_header));
+        if (s->hdr.size <= map_size - sizeof(snap_header))
+        {
+            s->data=realloc_check(s->data, s->hdr.size+1);
+            memcpy(s->data, map + sizeof(snap_header), s->hdr.size);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(h->seq), __ATOMIC_RELAXED) != seq)
+            continue;
+        if (s->hdr.size > map_size - sizeof(snap_header))
+            continue; /* the file has grown since we mapped it */
+
+        s->size=s->hdr.size;
+        s->data[s->size]=0;
+        /* it's only current if its daemon is still there */
+        if (snap_daemon_alive(lock_filename, s->hdr.pid))
+            ret=0;
+        break;
+    }
+    if (map)
+        munmap(map, map_size);
+    close(fd);
+    if (ret < 0)
+        snapshot_free(s);
+    return ret;
+}
+
+void snapshot_free(snapshot *s)
+{
+    free(s->data);
+    s->data=NULL;
+    s->size=0;
+}
+
+
+
+/* print with pf */
+static void snap_print(snapshot_print_func pf, void *ctx, const char *fmt, 
+                       ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    pf(ctx, fmt, ap);
+    va_end(ap);
+}
+
+/* get job record i */
+static const snap_job *snap_get_job(const snapshot *s, int i)
+{
+    if ((i+1)*sizeof(snap_job) > s->size)
+        return NULL;
+    return (const snap_job*)(s->data + i*sizeof(snap_job));
+}
+
+/* get a string from the data, which is empty if it isn't there */
+static const char *snap_get_string(const snapshot *s, uint32_t off)
+{
+    if (off == 0 || off >= s->size)
+        return "";
+    return s->data + off;
+}
+
+/* get the name of a job state */
+static const char *snap_state_string(int32_t state)
+{
+    if (state < run_error || state > done)
+        return "?";
+    return job_state_strings[state];
+}
+
+void snapshot_print_list(const snapshot *s, snapshot_print_func pf, 
+                         void *ctx)
+{
+    int i;
+
+    snap_print(pf, ctx, "running tasks: %4d\n", s->hdr.nrunning);
+    snap_print(pf, ctx, "max tasks:     %4d\n", s->hdr.ntask);
+
+    /* the queue is in order, so earlier jobs are printed first */
+    snap_print(pf, ctx, "%4s %4s %7s %5s %s\n", "ID", "PRIO", "STATE",     
+               "NTASK", "NAME");
+    for(i=0;i<s->hdr.njobs;i++)
+    {
+#define TASKSTRLEN 10
+        char taskstr[TASKSTRLEN];
+        const snap_job *sj=snap_get_job(s, i);
+
+        if (!sj)
+            break;
+        if (sj->ntask > 0)
+            snprintf(taskstr, TASKSTRLEN, sj->scavenger ? "%4ds" : "%5d", 
+                     sj->ntask);
+        else
+            snprintf(taskstr, TASKSTRLEN, "%5s", "block");
+
+        snap_print(pf, ctx, "%4d %4d %7s %5s '%s'", sj->id, sj->prio,
+                   sj->suspended ? "Susp" : snap_state_string(sj->state), 
+                   taskstr, snap_get_string(s, sj->name));
+        if (sj->oversub)
+            snap_print(pf, ctx, " (%d threads)", sj->nthread);
+        snap_print(pf, ctx, "\n");
+    }
+
+    if (s->hdr.njobs == 0)
+        snap_print(pf, ctx, "   No jobs.\n");
+}
+
+/* print the time t with a label */
+static void snap_print_time(snapshot_print_func pf, void *ctx, 
+                            const char *label, int64_t t)
+{
+    char timestr[26];
+    char *loc;
+    time_t tt=(time_t)t;
+
+    ctime_r(&tt, timestr);
+    loc=strchr(timestr, '\n'); /* remove newline */
+    if (loc)
+        *loc=0;
+    snap_print(pf, ctx, "%-22s%s\n", label, timestr);
+}
+
+/* print the details of a single job */
+static void snap_print_job(const snapshot *s, const snap_job *sj, 
+                           snapshot_print_func pf, void *ctx)
+{
+    snap_print(pf, ctx, "Name:                 %s\n", 
+               snap_get_string(s, sj->name));
+    snap_print(pf, ctx, "Job id:               %d\n", sj->id);
+    snap_print(pf, ctx, "Priority:             %d\n", sj->prio);
+    snap_print(pf, ctx, "State:                %s%s\n", 
+               snap_state_string(sj->state),
+               sj->suspended ? " (suspended)" : "");
+    if (sj->scavenger)
+        snap_print(pf, ctx, "Class:                scavenger\n");
+    snap_print_time(pf, ctx, "Submit time:", sj->sub_time);
+    if (sj->state==running || sj->state==started)
+    {
+        snap_print_time(pf, ctx, "Start time:", sj->start_time);
+        snap_print(pf, ctx, "Process id:           %d\n", sj->pid);
+        if (sj->leader_done)
+        {
+            snap_print(pf, ctx, "Main process:         exited; "
+                       "waiting for remaining processes\n");
+        }
+    }
+    if (sj->state==done)
+    {
+        snap_print_time(pf, ctx, "Start time:", sj->start_time);
+        snap_print_time(pf, ctx, "End time:", sj->end_time);
+        snap_print(pf, ctx, "Result:               %s\n", 
+                   snap_get_string(s, sj->result));
+        snap_print(pf, ctx, "User time:            %.2f s\n", sj->utime);
+        snap_print(pf, ctx, "System time:          %.2f s\n", sj->stime);
+        snap_print(pf, ctx, "Max. resident size:   %ld kB\n", 
+                   (long)sj->maxrss);
+        snap_print(pf, ctx, "Blocks in/out:        %ld/%ld\n", 
+                   (long)sj->inblock, (long)sj->oublock);
+        snap_print(pf, ctx, "CPU efficiency:       %.0f%%\n", 
+                   100.*sj->efficiency);
+        if (sj->cg_valid)
+        {
+            /* this includes processes that escaped the other accounting */
+            snap_print(pf, ctx, "Cgroup cpu time:      %.2f s (user "
+                       "%.2f s, system %.2f s)\n", sj->cg_usage, 
+                       sj->cg_user, sj->cg_system);
+            if (sj->cg_mem_peak >= 0)
+                snap_print(pf, ctx, "Cgroup peak memory:   %lld kB\n",
+                           (long long)sj->cg_mem_peak/1024);
+            if (sj->oom_kills > 0)
+                snap_print(pf, ctx, "OOM kills:            %d\n",
+                           sj->oom_kills);
+        }
+    }
+    if (sj->state==run_error || sj->state==resource_error)
+    {
+        snap_print(pf, ctx, "Error string:         %s\n", 
+                   snap_get_string(s, sj->error));
+    }
+
+    snap_print(pf, ctx, "Nr. of tasks:         %d\n", sj->ntask);
+    if (sj->state==running && sj->nsamples > 0)
+    {
+        snap_print(pf, ctx, "Nr. of threads:       %d (max. %d)%s\n", 
+                   sj->nthread, sj->nthread_max, 
+                   sj->oversub ? ": more than its tasks" : "");
+    }
+    if (sj->ntask_acct > 0)
+    {
+        snap_print(pf, ctx, "Accounted tasks:      %d\n", sj->ntask_acct);
+    }
+    if (sj->ncpus > 0)
+    {
+        snap_print(pf, ctx, "Nr. of cpus:          %d\n", sj->ncpus);
+    }
+    if (sj->mem_max > 0)
+    {
+        snap_print(pf, ctx, "Memory limit:         %lld kB\n", 
+                   (long long)sj->mem_max/1024);
+    }
+    if (sj->band)
+    {
+        snap_print(pf, ctx, "Scheduling band:      %s\n", 
+                   snap_get_string(s, sj->band));
+    }
+    if (sj->walltime > 0)
+    {
+        snap_print(pf, ctx, "Walltime limit:       %d:%02d:%02d\n",
+                   sj->walltime/3600, (sj->walltime/60)%60, 
+                   sj->walltime%60);
+    }
+    snap_print(pf, ctx, "Command:              %s\n", 
+               snap_get_string(s, sj->cmd));
+    snap_print(pf, ctx, "Nr. of args:          %d\n", sj->argc);
+    snap_print(pf, ctx, "Nr. of env vars:      %d\n", sj->envc);
+    snap_print(pf, ctx, "Working directory:    %s\n", 
+               snap_get_string(s, sj->wd));
+    snap_print(pf, ctx, "Output file:          %s\n", 
+               snap_get_string(s, sj->out));
+    snap_print(pf, ctx, "\n");
+}
+
+int snapshot_print_info(const snapshot *s, int id, snapshot_print_func pf,
+                        void *ctx)
+{
+    int found=0;
+    int i;
+
+    for(i=0;i<s->hdr.njobs;i++)
+    {
+        const snap_job *sj=snap_get_job(s, i);
+
+        if (sj && (id == -1 || sj->id == id))
+        {
+            if (pf)
+                snap_print_job(s, sj, pf, ctx);
+            found++;
+        }
+    }
+    /* and the recently finished ones, newest first */
+    for(i=s->hdr.njobs;i<s->hdr.njobs+s->hdr.ndone;i++)
+    {
+        const snap_job *sj=snap_get_job(s, i);
+
+        if (sj && (id == -1 || sj->id == id))
+        {
+            if (pf)
+                snap_print_job(s, sj, pf, ctx);
+            found++;
+            /* ids may get reused: only show the most recent one */
+            if (id != -1)
+                break;
+        }
+    }
+    return found;
+}
@@ -0,0 +1,181 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdarg.h>
+
+/* The queue snapshot: the daemon publishes the state of its jobs in a 
+   file that it maps into memory, so that 'suq ls' and 'suq info' can read
+   it without going through the socket.
+
+   The file starts with a header, followed by the data: a snap_job record
+   for each job (the queue in order, then the recently finished ones), and
+   the strings they refer to by their offset in the data. The daemon
+   rebuilds the data when the jobs change, and copies it into the file 
+   under a seqlock: the sequence number is odd while it writes, and a 
+   reader that sees it change has to read again. The file only grows, so
+   a reader's mapping never becomes invalid. */
+
+#define SNAP_MAGIC 0x50414e53 /* "SNAP" */
+#define SNAP_VERSION 1
+
+/* the file header */
+typedef struct snap_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seq; /* the seqlock sequence number */
+    int32_t pid; /* the daemon's pid, or 0 once it has exited */
+
+    /* the rest is written under the seqlock */
+    uint64_t size; /* the size of the data after the header */
+    int32_t ntask; /* the maximum number of tasks */
+    int32_t nrunning; /* the number of running tasks */
+    int32_t njobs; /* the number of jobs in the queue */
+    int32_t ndone; /* the number of recently finished jobs */
+} snap_header;
+
+/* a job. Strings are offsets into the data. */
+typedef struct snap_job
+{
+    int32_t id;
+    int32_t prio;
+    int32_t state; /* the job_state */
+    int32_t ntask;
+    int32_t scavenger;
+    int32_t suspended;
+    int32_t oversub;
+    int32_t leader_done;
+    int32_t pid;
+    int32_t nsamples; /* the number of samples of the running job */
+    int32_t nthread;
+    int32_t nthread_max;
+    int32_t ntask_acct;
+    int32_t ncpus;
+    int32_t walltime;
+    int32_t argc;
+    int32_t envc;
+    int32_t cg_valid; /* whether the cgroup accounting is there */
+    int32_t oom_kills;
+    int32_t pad;
+
+    int64_t sub_time;
+    int64_t start_time;
+    int64_t end_time;
+    int64_t mem_max;
+    int64_t maxrss;
+    int64_t inblock;
+    int64_t oublock;
+    int64_t cg_mem_peak;
+    double utime;
+    double stime;
+    double efficiency;
+    double cg_usage;
+    double cg_user;
+    double cg_system;
+
+    uint32_t name;
+    uint32_t cmd;
+    uint32_t wd;
+    uint32_t out;
+    uint32_t error; /* the error string, or 0 */
+    uint32_t result; /* the exit string of a finished job */
+    uint32_t band; /* the scheduling band, or 0 */
+    uint32_t pad2;
+} snap_job;
+
+/* a snapshot in memory: a copy of the header and of the data */
+typedef struct snapshot
+{
+    snap_header hdr;
+    char *data;
+    size_t size;
+} snapshot;
+
+/* the daemon's side of the snapshot */
+typedef struct snapshot_writer
+{
+    int fd; /* the file, or -1 if we couldn't make it */
+    char *filename;
+    char *map; /* the mapped file */
+    size_t map_size;
+
+    snapshot snap; /* the current snapshot */
+    size_t alloc; /* the allocated size of snap.data */
+    int dirty; /* whether the jobs have changed since it was made */
+} snapshot_writer;
+
+/* the function the formatters print with */
+typedef void (*snapshot_print_func)(void *ctx, const char *fmt, va_list ap);
+
+struct suq_serv;
+
+
+/* create the snapshot file filename, and map it. Without it, the daemon
+   still keeps its snapshot in memory. */
+void snapshot_writer_init(snapshot_writer *sw, const char *filename);
+
+/* mark the snapshot file as abandoned, and remove it. The snapshot is 
+   still kept in memory. */
+void snapshot_writer_stop(snapshot_writer *sw);
+
+/* mark the snapshot file as abandoned, and free everything */
+void snapshot_writer_destroy(snapshot_writer *sw);
+
+/* rebuild the snapshot from the server state if the jobs have changed, and
+   publish it in the file. Returns the current snapshot. */
+const snapshot *snapshot_update(snapshot_writer *sw, struct suq_serv *cs);
+
+
+/* read the snapshot in filename into s. Returns 0 on success, and -1 if
+   there's no usable snapshot: no file, or no daemon to keep it current
+   (one that holds the lock in lock_filename). */
+int snapshot_read(const char *filename, const char *lock_filename, 
+                  snapshot *s);
+
+/* free a snapshot that was read */
+void snapshot_free(snapshot *s);
+
+
+/* print the job list of 'suq ls' */
+void snapshot_print_list(const snapshot *s, snapshot_print_func pf, 
+                         void *ctx);
+
+/* print the details of 'suq info' for the job with id, or all jobs if id
+   is -1. Returns the number of jobs printed; with pf NULL, only counts
+   them. */
+int snapshot_print_info(const snapshot *s, int id, snapshot_print_func pf,
+                        void *ctx);
+
+#endif /* __SNAPSHOT_H__ */
@@ -0,0 +1,234 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "err.h"
+#include "timer.h"
+
+
+/* get the current monotonic time in milliseconds */
+static unsigned long timer_now_ms(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+        fatal_server_system_error("clock_gettime");
+    return ts.tv_sec*1000UL + ts.tv_nsec/1000000UL;
+}
+
+/* insert a timer into the slot list that matches its expiry time */
+static void timer_wheel_insert(timer_wheel *tw, suq_timer *t)
+{
+    unsigned long expires=t->expires;
+    unsigned long delta;
+    int level=0;
+    suq_timer *head;
+
+    if (expires < tw->now)
+        expires=tw->now;
+    delta=expires - tw->now;
+
+    while ( (level < TIMER_LEVELS-1) && 
+            (delta >= (1UL << ((level+1)*TIMER_SLOT_BITS))) )
+    {
+        level++;
+    }
+    if (delta >= (1UL << (TIMER_LEVELS*TIMER_SLOT_BITS)))
+    {
+        /* out of range: park it in the furthest slot. It will be 
+           re-inserted when that slot cascades. */
+        expires=tw->now + (1UL << (TIMER_LEVELS*TIMER_SLOT_BITS)) - 1;
+    }
+
+    head=&(tw->slots[level][(expires >> (level*TIMER_SLOT_BITS)) & 
+                            TIMER_SLOT_MASK]);
+    t->prev=head->prev;
+    t->next=head;
+    t->next->prev=t;
+    t->prev->next=t;
+}
+
+/* move all timers in a slot of a higher level to lower levels. Returns the
+   index of the slot. */
+static int timer_wheel_cascade(timer_wheel *tw, int level)
+{
+    int index=(tw->now >> (level*TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+    suq_timer *head=&(tw->slots[level][index]);
+    suq_timer *t=head->next;
+
+    /* detach the list first, because timers may end up in this slot again */
+    head->next=head->prev=head;
+    while(t != head)
+    {
+        suq_timer *next=t->next;
+        timer_wheel_insert(tw, t);
+        t=next;
+    }
+    return index;
+}
+
+
+
+void timer_wheel_init(timer_wheel *tw)
+{
+    int i,l;
+
+    for(l=0;l<TIMER_LEVELS;l++)
+    {
+        for(i=0;i<TIMER_SLOTS;i++)
+        {
+            suq_timer *head=&(tw->slots[l][i]);
+            head->next=head->prev=head;
+        }
+    }
+    tw->N=0;
+    tw->now=timer_now_ms()/TIMER_TICK_MS;
+}
+
+long timer_wheel_timeout(timer_wheel *tw)
+{
+    unsigned long now_ms;
+    unsigned long next;
+    int i;
+
+    if (tw->N == 0)
+        return -1;
+
+    /* the next point at which level 0 wraps around and the higher levels
+       cascade. That's when we need to wake up at the latest. */
+    next=(tw->now | TIMER_SLOT_MASK) + 1;
+    for(i=0;i<TIMER_SLOTS;i++)
+    {
+        unsigned long tick=tw->now + i;
+        suq_timer *head;
+
+        if (tick >= next)
+            break;
+        head=&(tw->slots[0][tick & TIMER_SLOT_MASK]);
+        if (head->next != head)
+        {
+            next=tick;
+            break;
+        }
+    }
+
+    now_ms=timer_now_ms();
+    if (next*TIMER_TICK_MS <= now_ms)
+        return 0;
+    return next*TIMER_TICK_MS - now_ms;
+}
+
+void timer_wheel_run(timer_wheel *tw)
+{
+    unsigned long target=timer_now_ms()/TIMER_TICK_MS;
+
+    if (tw->N == 0)
+    {
+        /* nothing to do: just catch up */
+        if (target > tw->now)
+            tw->now=target;
+        return;
+    }
+
+    while(tw->now <= target)
+    {
+        int index=tw->now & TIMER_SLOT_MASK;
+        suq_timer *head=&(tw->slots[0][index]);
+        int level=1;
+
+        /* cascade the higher levels when the lower level wraps around */
+        if (index == 0)
+        {
+            while( (level < TIMER_LEVELS) && 
+                   (timer_wheel_cascade(tw, level) == 0) )
+            {
+                level++;
+            }
+        }
+
+        /* run the expired timers. They may add or remove timers 
+           (including themselves), so we re-check the head every time. */
+        while(head->next != head)
+        {
+            suq_timer *t=head->next;
+
+            timer_del(t);
+            t->func(t, t->data);
+        }
+        tw->now++;
+    }
+}
+
+
+
+void timer_init(suq_timer *t, suq_timer_func func, void *data)
+{
+    t->func=func;
+    t->data=data;
+    t->tw=NULL;
+    t->next=t->prev=NULL;
+    t->expires=0;
+}
+
+void timer_add(timer_wheel *tw, suq_timer *t, unsigned long delay_ms)
+{
+    timer_del(t);
+
+    /* round up, so we never expire early */
+    t->expires=(timer_now_ms() + delay_ms + TIMER_TICK_MS - 1)/TIMER_TICK_MS;
+    t->tw=tw;
+    timer_wheel_insert(tw, t);
+    tw->N++;
+}
+
+void timer_del(suq_timer *t)
+{
+    if (!t->tw)
+        return;
+
+    t->next->prev=t->prev;
+    t->prev->next=t->next;
+    t->next=t->prev=NULL;
+    t->tw->N--;
+    t->tw=NULL;
+}
+
+int timer_active(suq_timer *t)
+{
+    return t->tw != NULL;
+}
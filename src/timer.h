@@ -0,0 +1,98 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __TIMER_H__
+#define __TIMER_H__
+
+/* the resolution of the timers, in milliseconds */
+#define TIMER_TICK_MS 100
+
+/* the timer wheel has TIMER_LEVELS levels of TIMER_SLOTS slots each. Every
+   level covers TIMER_SLOTS times the range of the level below it, so
+   with 100 ms ticks, 4 levels of 64 slots cover about 19 days. Longer 
+   timers are re-inserted when they come within range. */
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1<<TIMER_SLOT_BITS)
+#define TIMER_SLOT_MASK (TIMER_SLOTS-1)
+#define TIMER_LEVELS 4
+
+struct suq_timer;
+struct timer_wheel;
+
+/* the function called when a timer expires */
+typedef void (*suq_timer_func)(struct suq_timer *t, void *data);
+
+typedef struct suq_timer
+{
+    unsigned long expires; /* the expiry time in ticks */
+
+    suq_timer_func func; /* the function to call */
+    void *data; /* its argument */
+
+    struct timer_wheel *tw; /* the wheel we're in, or NULL if not active */
+    struct suq_timer *next, *prev; /* timers are in circular slot lists */
+} suq_timer;
+
+/* a hierarchical timer wheel: adding and removing timers is O(1), and
+   timers are only touched again when their level cascades down. */
+typedef struct timer_wheel
+{
+    unsigned long now; /* the current time in ticks; all timers that 
+                          expire earlier have been run */
+    int N; /* the number of active timers */
+
+    suq_timer slots[TIMER_LEVELS][TIMER_SLOTS]; /* dummy slot list heads */
+} timer_wheel;
+
+
+/* initialize a timer wheel */
+void timer_wheel_init(timer_wheel *tw);
+
+/* get the number of milliseconds until the next timer needs attention, 
+   or -1 if there are no timers */
+long timer_wheel_timeout(timer_wheel *tw);
+
+/* run all timers that have expired */
+void timer_wheel_run(timer_wheel *tw);
+
+
+/* initialize a timer with the function to call on expiry */
+void timer_init(suq_timer *t, suq_timer_func func, void *data);
+
+/* (re)start a timer to expire after delay_ms milliseconds */
+void timer_add(timer_wheel *tw, suq_timer *t, unsigned long delay_ms);
+
+/* stop a timer. It's safe to call this on inactive timers */
+void timer_del(suq_timer *t);
+
+/* whether a timer is active */
+int timer_active(suq_timer *t);
+
+#endif /* __TIMER_H__ */
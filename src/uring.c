@@ -0,0 +1,228 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+#include "uring.h"
+
+
+/* the ring is shared with the kernel: its head and tail are read and
+   written with acquire/release ordering */
+#define uring_load(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define uring_store(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+static int uring_enter(uring *r, unsigned to_submit, unsigned min_complete,
+                       unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+                        flags, arg, argsz);
+}
+
+/* publish our tail, and return the number of entries the kernel hasn't
+   taken yet */
+static unsigned uring_flush(uring *r)
+{
+    uring_store(r->sq_tail, r->sq_tail_local);
+    return r->sq_tail_local - uring_load(r->sq_head);
+}
+
+int uring_init(uring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    unsigned i;
+
+    memset(r, 0, sizeof(uring));
+    memset(&p, 0, sizeof(p));
+    r->fd=(int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+    if (!(p.features & IORING_FEAT_EXT_ARG))
+    {
+        close(r->fd);
+        r->fd=-1;
+        errno=ENOSYS;
+        return -1;
+    }
+
+    r->sq_size=p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    r->cq_size=p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_size > r->sq_size)
+            r->sq_size=r->cq_size;
+        r->cq_size=r->sq_size;
+    }
+    r->sq_ptr=mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, 
+                   MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->cq_ptr=r->sq_ptr;
+    }
+    else
+    {
+        r->cq_ptr=mmap(NULL, r->cq_size, PROT_READ|PROT_WRITE, 
+                       MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+        {
+            r->cq_ptr=NULL;
+            goto fail;
+        }
+    }
+    r->sqes_size=p.sq_entries*sizeof(struct io_uring_sqe);
+    r->sqes=mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, 
+                 MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes=NULL;
+        goto fail;
+    }
+
+    r->sq_head=(unsigned*)((char*)r->sq_ptr + p.sq_off.head);
+    r->sq_tail=(unsigned*)((char*)r->sq_ptr + p.sq_off.tail);
+    r->sq_mask=(unsigned*)((char*)r->sq_ptr + p.sq_off.ring_mask);
+    r->sq_array=(unsigned*)((char*)r->sq_ptr + p.sq_off.array);
+    r->cq_head=(unsigned*)((char*)r->cq_ptr + p.cq_off.head);
+    r->cq_tail=(unsigned*)((char*)r->cq_ptr + p.cq_off.tail);
+    r->cq_mask=(unsigned*)((char*)r->cq_ptr + p.cq_off.ring_mask);
+    r->cqes=(struct io_uring_cqe*)((char*)r->cq_ptr + p.cq_off.cqes);
+    r->sq_tail_local=*(r->sq_tail);
+
+    /* the submission entries are always used in order */
+    for(i=0;i<p.sq_entries;i++)
+        r->sq_array[i]=i;
+    return 0;
+fail:
+    {
+        int err=errno;
+
+        if (r->sq_ptr == MAP_FAILED)
+            r->sq_ptr=NULL;
+        uring_destroy(r);
+        errno=err;
+    }
+    return -1;
+}
+
+void uring_destroy(uring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_size);
+    if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+        munmap(r->cq_ptr, r->cq_size);
+    if (r->sq_ptr)
+        munmap(r->sq_ptr, r->sq_size);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->sqes=NULL;
+    r->cq_ptr=NULL;
+    r->sq_ptr=NULL;
+    r->fd=-1;
+}
+
+struct io_uring_sqe *uring_get_sqe(uring *r)
+{
+    struct io_uring_sqe *sqe;
+    unsigned entries=*(r->sq_mask)+1;
+
+    if (r->sq_tail_local - uring_load(r->sq_head) >= entries)
+    {
+        /* full: hand what we have to the kernel without waiting */
+        if (uring_enter(r, uring_flush(r), 0, 0, NULL, 0) < 0)
+            return NULL;
+        if (r->sq_tail_local - uring_load(r->sq_head) >= entries)
+        {
+            errno=EBUSY;
+            return NULL;
+        }
+    }
+    sqe=&(r->sqes[r->sq_tail_local & *(r->sq_mask)]);
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    r->sq_tail_local++;
+    return sqe;
+}
+
+int uring_submit_and_wait(uring *r, long timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned to_submit=uring_flush(r);
+    /* don't wait if there are completions left from before */
+    unsigned min_complete=uring_peek_cqe(r) ? 0 : 1;
+
+    memset(&arg, 0, sizeof(arg));
+    if (timeout >= 0 && min_complete)
+    {
+        ts.tv_sec=timeout/1000;
+        ts.tv_nsec=(timeout%1000)*1000000;
+        arg.ts=(uint64_t)(uintptr_t)&ts;
+    }
+    if (uring_enter(r, to_submit, min_complete, 
+                    IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, 
+                    &arg, sizeof(arg)) < 0)
+    {
+        /* EBUSY means the completion queue overflowed: we can still
+           handle what's in it */
+        if (errno == EBUSY && uring_peek_cqe(r))
+            return 0;
+        return -1;
+    }
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring *r)
+{
+    unsigned head=*(r->cq_head);
+
+    if (head == uring_load(r->cq_tail))
+        return NULL;
+    return &(r->cqes[head & *(r->cq_mask)]);
+}
+
+void uring_cqe_seen(uring *r)
+{
+    uring_store(r->cq_head, *(r->cq_head)+1);
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,96 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+/* A minimal io_uring submission/completion ring, on top of the raw 
+   system calls so we don't need liburing. It's only built with 
+   HAVE_IO_URING, and is used by the event loop (see event.c). */
+
+#ifdef HAVE_IO_URING
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+typedef struct uring
+{
+    int fd; /* the ring's file descriptor */
+
+    /* the submission queue, shared with the kernel */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_tail_local; /* our tail: entries up to here are filled */
+
+    /* the completion queue, shared with the kernel */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* the mappings */
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+} uring;
+
+
+/* set up a ring with room for entries submissions. The kernel must 
+   support waiting with a timeout (IORING_FEAT_EXT_ARG, Linux 5.11).
+   Returns 0 on success, or -1 with errno set. */
+int uring_init(uring *r, unsigned entries);
+
+/* close the ring */
+void uring_destroy(uring *r);
+
+/* get a cleared submission entry to fill in. If the queue is full, the
+   entries in it are submitted first. Returns NULL on error. */
+struct io_uring_sqe *uring_get_sqe(uring *r);
+
+/* submit the filled entries and wait until there's at least one 
+   completion, for at most timeout ms (forever if timeout<0). This is
+   one system call. Returns 0 when there are completions, or -1 with
+   errno set (ETIME on a timeout). */
+int uring_submit_and_wait(uring *r, long timeout);
+
+/* return the oldest completion, or NULL if there are none */
+struct io_uring_cqe *uring_peek_cqe(uring *r);
+
+/* mark the completion returned by uring_peek_cqe() as handled */
+void uring_cqe_seen(uring *r);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* __URING_H__ */
@@ -43,12 +43,18 @@ THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "err.h"
 
 const char *usage_string =
-"Usage: suq run [-d workdir] [-n ntasks] [-p pri] cmd args\n"
+"Usage: suq run [-d workdir] [-n ntasks] [-p pri] [-t time] [-m mem] [-s]\n"
+"               [-E] [-o file] cmd args\n"
 "       suq del [all|id]\n"
 "       suq pri id priority\n"
 "       suq ls\n"
+"       suq top\n"
 "       suq wait [all|id]\n"
+"       suq watch [-n name] [id ...]\n"
 "       suq ntask n\n"
+"       suq stats\n"
+"       suq start\n"
+"       suq batch [-t]\n"
 "       suq help\n"
 "\n"
 "suq, the Single User Queuer, takes shell commands and queues them to run in\n"
@@ -56,9 +62,16 @@ const char *usage_string =
 "\n"
 "Command summary:\n"
 "\n"
-"suq run [-d workdir] [-n ntasks] [-p pri] cmd args\n"
+"suq run [-d workdir] [-n ntasks] [-p pri] [-t time] [-m mem] [-s] [-E]\n"
+"        [-o file] cmd args\n"
 "   Submits a job for running. This job has command cmd and (optional)\n"
-"   arguments.\n"
+"   arguments. With -t, the job is killed after running for the given\n"
+"   time ([[hh:]mm:]ss). With -m, its memory is limited (as in 512M) where\n"
+"   cgroups allow that. The job's environment gets SUQ_JOB_ID, SUQ_NTASK,\n"
+"   SUQ_CPUS and thread counts such as OMP_NUM_THREADS, unless it sets them\n"
+"   itself or -E is given. With -s, the job is a scavenger: it only runs\n"
+"   on cpus that are idle, and it is suspended when other jobs need them.\n"
+"   Its output goes to name.id.out in its directory, or with -o, to file.\n"
 "\n"
 "suq del [id|all]\n"
 "   Deletes a job from the queue, and kills the job if it is already running.\n"
@@ -71,8 +84,12 @@ const char *usage_string =
 "suq ls\n"
 "   Lists all jobs in the queue\n"
 "\n"
+"suq top\n"
+"   Shows the CPU, memory and I/O usage of the running jobs.\n"
+"\n"
 "suq info id\n"
-"   Gives detailed information about a job.\n"
+"   Gives detailed information about a job. For recently finished jobs, this\n"
+"   includes the exit status and resource usage.\n"
 "\n"
 "suq wait [all|id]\n"
 "   Wait until jobs complete. If the argument is:\n"
@@ -81,9 +98,28 @@ const char *usage_string =
 "     'all'   : Wait until all jobs are finished\n"
 "     id      : Wait until a specific job with given id is finished\n"
 "\n"
-"suq ntask n\n"
+"suq watch [-n name] [id ...]\n"
+"   Prints a line for each job event (submitted, started, finished, ...)\n"
+"   as it happens, until interrupted. Only events of jobs with the given\n"
+"   ids or names are printed, if any are given.\n"
+"\n"
+"suq ntask [n]\n"
 "   Sets the total number of tasks (processes/threads) that may run \n"
-"   simultaneously.\n"
+"   simultaneously. Without n, shows it with the cpus and memory that\n"
+"   were detected, and why.\n"
+"\n"
+"suq stats\n"
+"   Shows the queuer's uptime and counts of requests and connections.\n"
+"\n"
+"suq start\n"
+"   Starts the queuer if it isn't running, so that later commands don't\n"
+"   have to. It stays up for 'linger' seconds (60) once it is idle.\n"
+"\n"
+"suq batch [-t]\n"
+"   Reads commands (such as 'info 3' or 'pri 3 10') from standard input,\n"
+"   one per line, and sends them all over one connection. The replies are\n"
+"   printed as they arrive; with -t, they are prefixed with the line\n"
+"   number of their command.\n"
 "\n"
 "suq help\n"
 "   Prints a more complete help message\n";
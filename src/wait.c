@@ -52,11 +52,13 @@ void jobwait_init(jobwait *jw)
 {
     jw->next=jw->next=NULL;
     jw->conn=NULL;
+    jw->tag=NULL;
 }
 
 void jobwait_destroy(jobwait *jw)
 {
-
+    free(jw->tag);
+    jw->tag=NULL;
 }
 
 #define MAXREPLEN 1024
@@ -83,11 +85,13 @@ void jobwait_close_connection(jobwait *jw, conn_list *cl)
     }
     if (jw->conn)
     {
-        if (write(jw->conn->write_fd, outstring, strlen(outstring)+1)<0)
+        if (connection_write_reply(jw->conn, jw->tag, 0, outstring, 
+                                   strlen(outstring))<0)
         {
             server_error("Write to client failed");
         }
-        conn_list_remove(cl, jw->conn);
+        if (!jw->conn->session)
+            conn_list_remove_flushed(cl, jw->conn);
         jw->conn=NULL;
     }
 }
@@ -52,6 +52,7 @@ typedef struct jobwait
     time_t last_sub_time; /* the submission time to check for */
 
     struct connection *conn;
+    char *tag; /* the tag of the wait request, if it came in a session */
 
     struct jobwait *next, *prev;
 } jobwait;
@@ -61,7 +62,8 @@ void jobwait_init(jobwait *jw);
 /* remove data from jobwait. Assumes connection is closed */
 void jobwait_destroy(jobwait *jw);
 
-/* close the wait and the associated connection */
+/* send the final reply of the wait, and close the associated connection
+   unless it's a session */
 void jobwait_close_connection(jobwait *jw, conn_list *cl);
 
 
@@ -0,0 +1,183 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "protocol.h"
+#include "job.h"
+#include "watch.h"
+
+
+void jobwatch_init(jobwatch *jw)
+{
+    jw->conn=NULL;
+    jw->tag=NULL;
+    jw->ids=NULL;
+    jw->nids=0;
+    jw->names=NULL;
+    jw->nnames=0;
+    jw->next=jw->prev=NULL;
+}
+
+void jobwatch_destroy(jobwatch *jw)
+{
+    int i;
+
+    for(i=0; i<jw->nnames; i++)
+        free(jw->names[i]);
+    free(jw->names);
+    free(jw->ids);
+    free(jw->tag);
+    jobwatch_init(jw);
+}
+
+void jobwatch_add_id(jobwatch *jw, int id)
+{
+    jw->ids=realloc_check_server(jw->ids, sizeof(int)*(jw->nids+1));
+    jw->ids[jw->nids++]=id;
+}
+
+void jobwatch_add_name(jobwatch *jw, const char *name)
+{
+    size_t len=strlen(name)+1;
+
+    jw->names=realloc_check_server(jw->names, 
+                                   sizeof(char*)*(jw->nnames+1));
+    jw->names[jw->nnames]=malloc_check_server(len);
+    memcpy(jw->names[jw->nnames], name, len);
+    jw->nnames++;
+}
+
+int jobwatch_matches(jobwatch *jw, job *j)
+{
+    int i;
+
+    if (jw->nids > 0)
+    {
+        for(i=0; i<jw->nids; i++)
+        {
+            if (jw->ids[i] == j->id)
+                break;
+        }
+        if (i == jw->nids)
+            return 0;
+    }
+    if (jw->nnames > 0)
+    {
+        for(i=0; i<jw->nnames; i++)
+        {
+            if (strcmp(jw->names[i], j->name) == 0)
+                break;
+        }
+        if (i == jw->nnames)
+            return 0;
+    }
+    return 1;
+}
+
+
+void jobwatch_list_init(jobwatch_list *wl)
+{
+    wl->head= &(wl->head_elem);
+    wl->head->next=wl->head;
+    wl->head->prev=wl->head;
+    wl->N=0;
+}
+
+void jobwatch_list_destroy(jobwatch_list *wl)
+{
+    while(wl->head->next != wl->head)
+        jobwatch_list_remove(wl, wl->head->next);
+}
+
+void jobwatch_list_add(jobwatch_list *wl, jobwatch *jw)
+{
+    jw->next=wl->head;
+    jw->prev=wl->head->prev;
+    wl->head->prev->next=jw;
+    wl->head->prev=jw;
+    wl->N++;
+}
+
+void jobwatch_list_remove(jobwatch_list *wl, jobwatch *jw)
+{
+    jw->next->prev=jw->prev;
+    jw->prev->next=jw->next;
+    wl->N--;
+    if (debug>1)
+        printf("SERVER: removing watch\n");
+    jobwatch_destroy(jw);
+    free(jw);
+}
+
+int jobwatch_list_remove_conn(jobwatch_list *wl, connection *c)
+{
+    jobwatch *jw=wl->head->next;
+    int n=0;
+
+    while(jw != wl->head)
+    {
+        jobwatch *next=jw->next;
+        if (jw->conn == c)
+        {
+            jobwatch_list_remove(wl, jw);
+            n++;
+        }
+        jw=next;
+    }
+    return n;
+}
+
+void jobwatch_list_send(jobwatch_list *wl, job *j, const char *line)
+{
+    jobwatch *jw=wl->head->next;
+    size_t len=strlen(line);
+
+    while(jw != wl->head)
+    {
+        /* a client that doesn't keep up gets its connection marked dead,
+           after which the watch is removed with it */
+        if (!jw->conn->dead && jobwatch_matches(jw, j))
+        {
+            connection_write_reply(jw->conn, jw->tag, PROTO_FLAG_PARTIAL,
+                                   line, len);
+        }
+        jw=jw->next;
+    }
+}
+
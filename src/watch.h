@@ -0,0 +1,89 @@
+/* This source code is part of 
+
+suq, the Single-User Queuer
+
+Copyright (c) 2010 Sander Pronk
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+1. Redistributions of source code must retain the above copyright
+   notice, this list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright
+   notice, this list of conditions and the following disclaimer in the
+   documentation and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include "connection.h"
+
+struct job;
+
+/* a subscription to job events, made with 'suq watch'. */
+typedef struct jobwatch
+{
+    struct connection *conn; /* where the events go */
+    char *tag; /* the tag of the watch request, if it came in a session */
+
+    int *ids; /* the job ids to report on; all jobs if there are none */
+    int nids; 
+    char **names; /* the job names to report on; all if there are none */
+    int nnames;
+
+    struct jobwatch *next, *prev;
+} jobwatch;
+
+/* the circular list header */
+typedef struct jobwatch_list
+{
+    jobwatch *head; /* the dummy head element */
+    int N; /* the number of elems */
+
+    jobwatch head_elem; /* the pre-allocated head element */
+} jobwatch_list;
+
+
+void jobwatch_init(jobwatch *jw);
+void jobwatch_destroy(jobwatch *jw);
+
+/* add a job id to report on */
+void jobwatch_add_id(jobwatch *jw, int id);
+/* add a job name to report on */
+void jobwatch_add_name(jobwatch *jw, const char *name);
+
+/* check whether a job passes the watch's filters */
+int jobwatch_matches(jobwatch *jw, struct job *j);
+
+
+void jobwatch_list_init(jobwatch_list *wl);
+/* remove and free all watches */
+void jobwatch_list_destroy(jobwatch_list *wl);
+
+/* add a watch to the list */
+void jobwatch_list_add(jobwatch_list *wl, jobwatch *jw);
+/* remove a watch from the list and free it. Leaves the connection alone */
+void jobwatch_list_remove(jobwatch_list *wl, jobwatch *jw);
+/* remove all watches of a connection. Returns the number removed */
+int jobwatch_list_remove_conn(jobwatch_list *wl, struct connection *c);
+
+/* send an event line for job j to all watches that want it */
+void jobwatch_list_send(jobwatch_list *wl, struct job *j, const char *line);
+
+#endif
+